@@ -35,6 +35,19 @@ nbogl3_render(
         struct nbr_draw_data *draw);
 
 
+/*
+ * Buffers recorded with nbr_cmd_buf_init_mapped are drawn straight from
+ * `vbo` and `ibo` with no upload. Their vertex and index memory has to be
+ * mapped from the start of each, and unmapped or coherent by render time.
+ * Zero for both goes back to uploading every buffer.
+ */
+nb_result
+nbogl3_mapped_buffers_set(
+        nbogl3_ctx_t ctx,
+        uint32_t vbo,
+        uint32_t ibo);
+
+
 /* inc guard */
 #endif
 
@@ -106,6 +119,7 @@ typedef void (APIENTRYP PFNGLBINDBUFFERPROC)(GLenum type, GLuint buffer_id);
 typedef void (APIENTRYP PFNGLBINDVERTEXARRAYPROC)(GLuint vao);
 typedef void (APIENTRYP PFNGLBUFFERDATAPROC)(GLenum, GLsizeiptr, const GLvoid*, GLenum use);
 typedef void (APIENTRYP PFNGLCOMPILESHADERPROC)(GLuint shd);
+typedef void (APIENTRYP PFNGLDRAWELEMENTSBASEVERTEXPROC)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLint basevertex);
 typedef GLuint (APIENTRYP PFNGLCREATEPROGRAMPROC)(void);
 typedef void (APIENTRYP PFNGLENABLEVERTEXATTRIBARRAYPROC)(GLuint idx);
 typedef void (APIENTRYP PFNGLGENBUFFERSPROC)(GLsizei n, GLuint *buffs);
@@ -138,6 +152,7 @@ PFNGLBINDBUFFERPROC glBindBuffer_neb;
 PFNGLBINDVERTEXARRAYPROC glBindVertexArray_neb;
 PFNGLBUFFERDATAPROC glBufferData_neb;
 PFNGLCOMPILESHADERPROC glCompileShader_neb;
+PFNGLDRAWELEMENTSBASEVERTEXPROC glDrawElementsBaseVertex_neb;
 PFNGLCREATEPROGRAMPROC glCreateProgram_neb;
 PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray_neb;
 PFNGLGENBUFFERSPROC glGenBuffers_neb;
@@ -165,6 +180,7 @@ PFNGVERTEXATTRIBPOINTERPROC glVertexAttribPointer_neb;
 #define glBindVertexArray glBindVertexArray_neb
 #define glBufferData glBufferData_neb
 #define glCompileShader glCompileShader_neb
+#define glDrawElementsBaseVertex glDrawElementsBaseVertex_neb
 #define glCreateProgram glCreateProgram_neb
 #define glEnableVertexAttribArray glEnableVertexAttribArray_neb
 #define glGenBuffers glGenBuffers_neb
@@ -224,11 +240,14 @@ glPopDebugGroup_neb() {
 
 
 struct nbogl3_ctx {
-        GLuint ftex[NBR_FONT_COUNT_MAX];
+        GLuint ftex;
+        uint32_t ftex_generation;
         GLuint vao;
         GLuint pro;
         GLuint vbo, ibo;
-        GLint unitex, uniproj;
+        GLuint mapped_vbo, mapped_ibo;
+        GLint unitex, uniproj, unisdf;
+        GLint sdf;
         GLint inpos, intex, incol;
 };
 
@@ -271,6 +290,86 @@ struct nbogl3_ctx {
 /* ---------------------------------------------------------------- Render -- */
 
 
+static void
+nbogl3_font_upload(
+        struct nbogl3_ctx *ctx,
+        nbr_ctx_t nbr_ctx)
+{
+        struct nb_font_tex atlas;
+        nb_get_font_atlas(nbr_ctx, &atlas);
+        assert(atlas.mem);
+
+        glBindTexture(GL_TEXTURE_2D, ctx->ftex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas.width, atlas.height, 0, GL_RED, GL_UNSIGNED_BYTE, atlas.mem);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        ctx->sdf = atlas.mode == NBR_FONT_MODE_SDF ? 1 : 0;
+        ctx->ftex_generation = atlas.generation;
+}
+
+
+/* the vao keeps the vbo the attributes were pointed at, so they are set again */
+static void
+nbogl3_buffers_bind(
+        struct nbogl3_ctx *ctx,
+        GLuint vbo,
+        GLuint ibo)
+{
+        glBindVertexArray(ctx->vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+
+        GLsizei stride = sizeof(struct nbr_vtx);
+        void *ptr = (void *)offsetof(struct nbr_vtx, x);
+#if NBR_VERTEX_COMPACT
+        /* fixed point positions are scaled back to pixels by the projection */
+        glVertexAttribPointer(ctx->inpos, 2, GL_SHORT, GL_FALSE, stride, ptr);
+#else
+        glVertexAttribPointer(ctx->inpos, 2, GL_FLOAT, GL_FALSE, stride, ptr);
+#endif
+
+        ptr = (void *)offsetof(struct nbr_vtx, u);
+#if NBR_VERTEX_COMPACT
+        glVertexAttribPointer(ctx->intex, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, ptr);
+#else
+        glVertexAttribPointer(ctx->intex, 2, GL_FLOAT, GL_FALSE, stride, ptr);
+#endif
+
+        ptr = (void *)offsetof(struct nbr_vtx, c);
+        glVertexAttribPointer(ctx->incol, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, stride, ptr);
+}
+
+
+/* all the state a pass draws with, set again after each callback */
+static void
+nbogl3_state_set(
+        struct nbogl3_ctx *ctx,
+        GLfloat proj[4][4],
+        uint32_t vp_width,
+        uint32_t vp_height)
+{
+        glDisable(GL_DEPTH_TEST);
+
+        glUseProgram(ctx->pro);
+        glUniformMatrix4fv(ctx->uniproj, 1, GL_FALSE, &proj[0][0]);
+        glViewport(0, 0, (GLsizei)vp_width, (GLsizei)vp_height);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+        glUniform1i(ctx->unitex, 0);
+        glUniform1i(ctx->unisdf, ctx->sdf);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, ctx->ftex);
+
+        nbogl3_buffers_bind(ctx, ctx->vbo, ctx->ibo);
+
+        glEnable(GL_SCISSOR_TEST);
+        // glEnable(GL_DEPTH_TEST);
+}
+
+
 nb_result
 nbogl3_render(
         nbogl3_ctx_t ctx,
@@ -292,8 +391,19 @@ nbogl3_render(
         uint32_t vp_width, vp_height;
         nbr_viewport_get(nbr_ctx, &vp_width, &vp_height);
 
-        /* setup gl */
-        glDisable(GL_DEPTH_TEST);
+        /* shared renderer ctxs leave the viewport to each draw */
+        if(draw->viewport[0] && draw->viewport[1]) {
+                vp_width = draw->viewport[0];
+                vp_height = draw->viewport[1];
+        }
+
+        /* fonts were added since the last upload */
+        struct nb_font_tex atlas;
+        nb_get_font_atlas(nbr_ctx, &atlas);
+
+        if(atlas.generation != ctx->ftex_generation) {
+                nbogl3_font_upload(ctx, nbr_ctx);
+        }
 
         /* prepare pass */
         GLfloat proj[4][4] = {
@@ -306,26 +416,16 @@ nbogl3_render(
         proj[0][0] /= (GLfloat)vp_width;
         proj[1][1] /= (GLfloat)vp_height;
 
-        glUseProgram(ctx->pro);
-        glUniformMatrix4fv(ctx->uniproj, 1, GL_FALSE, &proj[0][0]);
-        glViewport(0, 0, (GLsizei)vp_width, (GLsizei)vp_height);
-
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
-        unsigned int f_idx = nb_debug_get_font(nbr_ctx);
-        GLuint ftex = ctx->ftex[f_idx];
-
-        glUniform1i(ctx->unitex, 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, ftex);
+#if NBR_VERTEX_COMPACT
+        proj[0][0] /= (GLfloat)NBR_VERTEX_SUBPIXELS;
+        proj[1][1] /= (GLfloat)NBR_VERTEX_SUBPIXELS;
+#endif
 
-        glBindVertexArray(ctx->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->ibo);
+        nbogl3_state_set(ctx, proj, vp_width, vp_height);
 
-        glEnable(GL_SCISSOR_TEST);
-        // glEnable(GL_DEPTH_TEST);
+        /* callbacks get the scissor back along with the rest of the state */
+        GLint scissor[4];
+        glGetIntegerv(GL_SCISSOR_BOX, scissor);
 
 #if NBR_INDEX_SIZE == 8
         #define NB_OGL3_INDEX_TYPE GL_UNSIGNED_BYTE
@@ -338,39 +438,76 @@ nbogl3_render(
 #endif
 
         /* render */
+        GLuint bound_vbo = ctx->vbo;
         unsigned int buf_idx, i;
         for (buf_idx = 0; buf_idx < draw->cmd_buf_count; buf_idx++) {
-                struct nbr_cmd_buf *cmd_buf = draw->cmd_bufs[buf_idx];
+                /* growable buffers are drawn a chunk at a time */
+                struct nbr_cmd_buf *cmd_buf;
+                for (cmd_buf = draw->cmd_bufs[buf_idx]; cmd_buf; cmd_buf = cmd_buf->next) {
+                        if (!cmd_buf->cmd_count) {
+                                continue;
+                        }
 
-                struct nbr_vtx_buf *vtx_buf = &cmd_buf->vtx_buf;
-                glBufferData(GL_ARRAY_BUFFER, sizeof(struct nbr_vtx) * vtx_buf->vtx_count, vtx_buf->vtx, GL_STREAM_DRAW);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(nbr_idx) * vtx_buf->idx_count, vtx_buf->idx, GL_STREAM_DRAW);
+                        /* mapped buffers already live in the caller's vbo and ibo */
+                        int mapped = cmd_buf->mapped && ctx->mapped_vbo && ctx->mapped_ibo;
+                        GLuint vbo = mapped ? ctx->mapped_vbo : ctx->vbo;
+                        GLuint ibo = mapped ? ctx->mapped_ibo : ctx->ibo;
 
-                for (i = 0; i < cmd_buf->cmd_count; ++i) {
-                        struct nbr_cmd *cmd = cmd_buf->cmds + i;
+                        if (vbo != bound_vbo) {
+                                nbogl3_buffers_bind(ctx, vbo, ibo);
+                                bound_vbo = vbo;
+                        }
 
-                        if (cmd->type == NBR_CMD_TYPE_SCISSOR) {
-                                GLsizei w = cmd->data.clip_rect[2];
-                                GLsizei h = cmd->data.clip_rect[3];
+                        if (!mapped) {
+                                struct nbr_vtx_buf *vtx_buf = &cmd_buf->vtx_buf;
+                                glBufferData(GL_ARRAY_BUFFER, sizeof(struct nbr_vtx) * vtx_buf->vtx_count, vtx_buf->vtx, GL_STREAM_DRAW);
+                                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(nbr_idx) * vtx_buf->idx_count, vtx_buf->idx, GL_STREAM_DRAW);
+                        }
 
-                                GLint x = cmd->data.clip_rect[0];
-                                GLint y = vp_height - (cmd->data.clip_rect[1] + h);
+                        for (i = 0; i < cmd_buf->cmd_count; ++i) {
+                                struct nbr_cmd *cmd = cmd_buf->cmds + i;
 
-                                glScissor(x, y, w, h);
-                        }
-                        else {
-                                GLenum mode = GL_TRIANGLES;
+                                if (cmd->type == NBR_CMD_TYPE_SCISSOR) {
+                                        GLsizei w = cmd->data.clip_rect[2];
+                                        GLsizei h = cmd->data.clip_rect[3];
+
+                                        GLint x = cmd->data.clip_rect[0];
+                                        GLint y = vp_height - (cmd->data.clip_rect[1] + h);
 
-                                if (cmd->type == NBR_CMD_TYPE_LINES) {
-                                        mode = GL_LINE_STRIP;
+                                        glScissor(x, y, w, h);
+
+                                        scissor[0] = x;
+                                        scissor[1] = y;
+                                        scissor[2] = w;
+                                        scissor[3] = h;
                                 }
+                                else if (cmd->type == NBR_CMD_TYPE_CALLBACK) {
+                                        cmd->data.callback.fn(cmd->data.callback.user_data);
+
+                                        nbogl3_state_set(ctx, proj, vp_width, vp_height);
+                                        glScissor(scissor[0], scissor[1], scissor[2], scissor[3]);
 
-                                size_t offset = cmd->data.elem.offset * sizeof(nbr_idx);
-                                glDrawElements(
-                                        mode,
-                                        cmd->data.elem.count,
-                                        NB_OGL3_INDEX_TYPE,
-                                        (void *)((uint64_t)offset));
+                                        if (mapped) {
+                                                nbogl3_buffers_bind(ctx, vbo, ibo);
+                                        }
+                                        bound_vbo = vbo;
+                                }
+                                else {
+                                        GLenum mode = GL_TRIANGLES;
+
+                                        if (cmd->type == NBR_CMD_TYPE_LINES) {
+                                                mode = GL_LINES;
+                                        }
+
+                                        /* indices are relative to the command's base vertex */
+                                        size_t offset = cmd->data.elem.offset * sizeof(nbr_idx);
+                                        glDrawElementsBaseVertex(
+                                                mode,
+                                                cmd->data.elem.count,
+                                                NB_OGL3_INDEX_TYPE,
+                                                (void *)((uint64_t)offset),
+                                                (GLint)cmd->data.elem.vtx_offset);
+                                }
                         }
                 }
         }
@@ -385,6 +522,23 @@ nbogl3_render(
 }
 
 
+nb_result
+nbogl3_mapped_buffers_set(
+        nbogl3_ctx_t ctx,
+        uint32_t vbo,
+        uint32_t ibo)
+{
+        if (!ctx) {
+                return NB_INVALID_PARAMS;
+        }
+
+        ctx->mapped_vbo = (GLuint)vbo;
+        ctx->mapped_ibo = (GLuint)ibo;
+
+        return NB_OK;
+}
+
+
 /* -------------------------------------------------------------- Lifetime -- */
 
 
@@ -412,6 +566,7 @@ nbogl3_ctx_create(
         OGL3_LOAD_PROC(glBindVertexArray, PFNGLBINDVERTEXARRAYPROC);
         OGL3_LOAD_PROC(glBufferData, PFNGLBUFFERDATAPROC);
         OGL3_LOAD_PROC(glCompileShader, PFNGLCOMPILESHADERPROC);
+        OGL3_LOAD_PROC(glDrawElementsBaseVertex, PFNGLDRAWELEMENTSBASEVERTEXPROC);
         OGL3_LOAD_PROC(glCreateProgram, PFNGLCREATEPROGRAMPROC);
         OGL3_LOAD_PROC(glEnableVertexAttribArray, PFNGLENABLEVERTEXATTRIBARRAYPROC);
         OGL3_LOAD_PROC(glGenBuffers, PFNGLGENBUFFERSPROC);
@@ -442,23 +597,9 @@ nbogl3_ctx_create(
                         "Nebula OGL Create");
         }
 
-        unsigned int font_count = nb_get_font_count(nbr_ctx);
-        assert(font_count);
-
-        unsigned int i;
-
-        struct nb_font_tex font_tex_list[NBR_FONT_COUNT_MAX];
-        nb_get_font_tex_list(nbr_ctx, font_tex_list);
-        for (i = 0; i < font_count; i++) {
-                struct nb_font_tex * f = font_tex_list + i;
-
-                GLuint * ftex = ctx->ftex + i;
-                glGenTextures(1, ftex);
-                assert(*ftex);
-                glBindTexture(GL_TEXTURE_2D, *ftex);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, f->width, f->width, 0, GL_RED, GL_UNSIGNED_BYTE, f->mem);
-                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        }
+        glGenTextures(1, &ctx->ftex);
+        assert(ctx->ftex);
+        nbogl3_font_upload(ctx, nbr_ctx);
 
         const char * vs_src = "#version 150\n"
                 "in vec2 position;\n"
@@ -473,15 +614,22 @@ nbogl3_ctx_create(
                 "       gl_Position = projection * vec4(position.xy, 0, 1);\n"
                 "}";
 
+        /* sdf resolve matches nbr_sdf_coverage, a one pixel ramp at the edge */
         const char * fs_src = "#version 150\n"
                 "in vec2 frag_uv;\n"
                 "in vec4 frag_color;\n"
                 "uniform sampler2D texture_map;\n"
+                "uniform int sdf;\n"
                 "out vec4 out_color;\n"
                 "void main() {"
                 "       float a = frag_color.a;"
                 "       if(frag_uv.x != 0.0 || frag_uv.y != 0.0) {"
-                "               a *= texture(texture_map, frag_uv.xy).r;"
+                "               float t = texture(texture_map, frag_uv.xy).r;"
+                "               if(sdf != 0) {"
+                "                       float d = t - (128.0 / 255.0);"
+                "                       t = clamp(d / max(fwidth(t), 0.0001) + 0.5, 0.0, 1.0);"
+                "               }"
+                "               a *= t;"
                 "       }"
                 "       out_color = vec4(frag_color.rgb * a, a);\n"
                 "}";
@@ -513,6 +661,7 @@ nbogl3_ctx_create(
 
         ctx->unitex = glGetUniformLocation(ctx->pro, "texture_map");
         ctx->uniproj = glGetUniformLocation(ctx->pro, "projection");
+        ctx->unisdf = glGetUniformLocation(ctx->pro, "sdf");
         ctx->inpos = glGetAttribLocation(ctx->pro, "position");
         ctx->incol = glGetAttribLocation(ctx->pro, "color");
         ctx->intex = glGetAttribLocation(ctx->pro, "texcoord");
@@ -520,24 +669,16 @@ nbogl3_ctx_create(
         glGenBuffers(1, &ctx->ibo);
         glGenBuffers(1, &ctx->vbo);
         glGenVertexArrays(1, &ctx->vao);
+        ctx->mapped_vbo = 0;
+        ctx->mapped_ibo = 0;
 
         glBindVertexArray(ctx->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->ibo);
 
         glEnableVertexAttribArray(ctx->inpos);
         glEnableVertexAttribArray(ctx->incol);
         glEnableVertexAttribArray(ctx->intex);
 
-        GLsizei stride = sizeof(struct nbr_vtx);
-        void *ptr = (void *)offsetof(struct nbr_vtx, x);
-        glVertexAttribPointer(ctx->inpos, 2, GL_FLOAT, GL_FALSE, stride, ptr);
-
-        ptr = (void *)offsetof(struct nbr_vtx, u);
-        glVertexAttribPointer(ctx->intex, 2, GL_FLOAT, GL_FALSE, stride, ptr);
-
-        ptr = (void *)offsetof(struct nbr_vtx, c);
-        glVertexAttribPointer(ctx->incol, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, stride, ptr);
+        nbogl3_buffers_bind(ctx, ctx->vbo, ctx->ibo);
 
         if(NEB_OGL3_DEBUG_SUPPORT) {
                 glPopDebugGroup();
@@ -29,6 +29,138 @@ typedef uint32_t nbr_idx;
 #define NB_TAU 6.2831853071
 
 
+/*
+ * Embedded fonts can be left out of the build, fonts can then be loaded with
+ * `nbr_font_add_file` or `nbr_font_add_memory`.
+ */
+#ifndef NBR_FONT_EMBED_OPEN_SANS
+#define NBR_FONT_EMBED_OPEN_SANS 1
+#endif
+
+#ifndef NBR_FONT_EMBED_PROGGY
+#define NBR_FONT_EMBED_PROGGY 1
+#endif
+
+#ifndef NBR_FONT_EMBED_AWESOME
+#define NBR_FONT_EMBED_AWESOME 1
+#endif
+
+#ifndef NBR_FONT_FILE_SUPPORT
+#define NBR_FONT_FILE_SUPPORT 1
+#endif
+
+
+/*
+ * The glyph atlas is sized to fit the loaded fonts, these bound the power of
+ * two sizes that are tried.
+ */
+#ifndef NBR_ATLAS_SIZE_MIN
+#define NBR_ATLAS_SIZE_MIN 64
+#endif
+
+#ifndef NBR_ATLAS_SIZE_MAX
+#define NBR_ATLAS_SIZE_MAX 4096
+#endif
+
+
+/*
+ * Text measuring and vertex generation use SSE2 when the target has it.
+ */
+#ifndef NBR_SIMD_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NBR_SIMD_SSE2 1
+#else
+#define NBR_SIMD_SSE2 0
+#endif
+#endif
+
+
+/*
+ * Rounded corners get the fewest segments, up to NBR_CORNER_SEGMENTS_MAX,
+ * that keep each chord within NBR_CORNER_TOLERANCE pixels of the arc.
+ */
+#ifndef NBR_CORNER_SEGMENTS_MAX
+#define NBR_CORNER_SEGMENTS_MAX 16
+#endif
+
+#ifndef NBR_CORNER_TOLERANCE
+#define NBR_CORNER_TOLERANCE 0.25f
+#endif
+
+
+/*
+ * Curves are flattened to the fewest segments that stay within
+ * NBR_BEZ_TOLERANCE pixels, clamped to the min and max.
+ */
+#ifndef NBR_BEZ_TOLERANCE
+#define NBR_BEZ_TOLERANCE 0.25f
+#endif
+
+#ifndef NBR_BEZ_SEGMENTS_MIN
+#define NBR_BEZ_SEGMENTS_MIN 1
+#endif
+
+#ifndef NBR_BEZ_SEGMENTS_MAX
+#define NBR_BEZ_SEGMENTS_MAX 128
+#endif
+
+
+/*
+ * Vertices are 20 bytes with float positions and uvs. NBR_VERTEX_COMPACT
+ * packs them into 12, positions as 16 bit fixed point with
+ * NBR_VERTEX_SUBPIXELS steps per pixel and uvs normalized to 16 bits.
+ */
+#ifndef NBR_VERTEX_COMPACT
+#define NBR_VERTEX_COMPACT 0
+#endif
+
+#ifndef NBR_VERTEX_SUBPIXELS
+#define NBR_VERTEX_SUBPIXELS 4
+#endif
+
+
+/*
+ * Vertices and indices are written with non-temporal stores that skip the
+ * cache, for buffers recorded straight into mapped or write-combined memory
+ * with nbr_cmd_buf_init_mapped. Indices narrower than 32 bits are gathered
+ * into whole words first. Needs NBR_SIMD_SSE2, it is an error without it.
+ */
+#ifndef NBR_VERTEX_STREAM
+#define NBR_VERTEX_STREAM 0
+#endif
+
+
+/* depth of the clip stack in each command buffer */
+#ifndef NBR_CLIP_STACK_MAX
+#define NBR_CLIP_STACK_MAX 16
+#endif
+
+
+/* feathered edges fade out over this many pixels when anti-aliasing */
+#ifndef NBR_AA_FRINGE
+#define NBR_AA_FRINGE 1.0f
+#endif
+
+
+/* polyline miters longer than this many half widths are cut short */
+#ifndef NBR_POLYLINE_MITER_LIMIT
+#define NBR_POLYLINE_MITER_LIMIT 4.0f
+#endif
+
+
+/* SDF glyphs are baked once at this height and scaled to every font size */
+#ifndef NBR_SDF_BAKE_HEIGHT
+#define NBR_SDF_BAKE_HEIGHT 32.0f
+#endif
+
+#ifndef NBR_SDF_PADDING
+#define NBR_SDF_PADDING 4
+#endif
+
+#define NBR_SDF_ONEDGE 128
+#define NBR_SDF_DIST_SCALE (128.0f / (float)NBR_SDF_PADDING)
+
+
 typedef enum nb_text_align {
         NB_TEXT_ALIGN_LEFT = 0,
         NB_TEXT_ALIGN_RIGHT = 1,
@@ -38,22 +170,40 @@ typedef enum nb_text_align {
 } nb_text_align;
 
 
+typedef enum nbr_font_mode {
+        NBR_FONT_MODE_BITMAP = 0,           /* coverage glyphs, one bake per font height */
+        NBR_FONT_MODE_SDF = 1,              /* distance field glyphs, shared by all heights */
+} nbr_font_mode;
+
+
 typedef enum nbr_cmd_type {
         NBR_CMD_TYPE_TRIANGLES = 0,
-        NBR_CMD_TYPE_LINES = 1,
+        NBR_CMD_TYPE_LINES = 1,             /* index pairs, one segment each */
         NBR_CMD_TYPE_SCISSOR = 2,
+        NBR_CMD_TYPE_CALLBACK = 3,          /* the backend calls back between draws */
 } nbr_cmd_type;
 
 
+typedef void(*nbr_draw_callback_fn)(void *user_data);
+
+
 struct nbr_cmd_elem {
         uint32_t offset;
         uint32_t count;
+        uint32_t vtx_offset;                /* base vertex the indices are relative to */
+};
+
+
+struct nbr_cmd_callback {
+        nbr_draw_callback_fn fn;
+        void *user_data;
 };
 
 
 union nbr_cmd_data {
         struct nbr_cmd_elem elem;
         int16_t clip_rect[4];
+        struct nbr_cmd_callback callback;
 };
 
 
@@ -63,11 +213,19 @@ struct nbr_cmd {
 };
 
 
+#if NBR_VERTEX_COMPACT
+struct nbr_vtx {
+        int16_t x, y;                   /* NBR_VERTEX_SUBPIXELS steps per pixel */
+        uint16_t u, v;                  /* normalized */
+        uint32_t c;
+};
+#else
 struct nbr_vtx {
         float x, y;
         float u, v;
         uint32_t c;
 };
+#endif
 
 
 struct nbr_cmd_limits {
@@ -85,6 +243,30 @@ struct nbr_vtx_buf {
         nbr_idx *idx;
         uint32_t idx_count;
         uint32_t idx_count_max;
+
+        /* first vertex the current commands index from, moves on when nbr_idx runs out */
+        uint32_t vtx_base;
+
+        /* streamed indices of the word being filled and where they end, see NBR_VERTEX_STREAM */
+        uint32_t idx_word;
+        uint32_t idx_word_end;
+};
+
+
+/* room for custom geometry, see nbr_cmd_reserve */
+struct nbr_cmd_reservation {
+        struct nbr_vtx *vtx;
+        nbr_idx *idx;
+        nbr_idx base;                       /* index of vtx[0] */
+};
+
+
+struct nbr_cmd_stats {
+        uint32_t cmd_count;
+        uint32_t cmd_merged_count;          /* draws folded into the command before them */
+        uint32_t scissor_dropped_count;     /* scissors that changed nothing or were replaced */
+        uint32_t vtx_count;
+        uint32_t idx_count;
 };
 
 
@@ -92,50 +274,135 @@ struct nbr_cmd_buf {
         struct nbr_cmd *cmds;
         uint32_t cmd_count;
         uint32_t cmd_count_max;
+        uint32_t cmd_merged_count;
+        uint32_t scissor_dropped_count;
 
         struct nbr_vtx_buf vtx_buf;
+
+        /* glyphs and sharp boxes are clipped to the top on the CPU */
+        struct nb_rect clip_stack[NBR_CLIP_STACK_MAX];
+        uint32_t clip_count;
+
+        /* last scissor recorded, unknown until the first one */
+        int16_t scissor[4];
+        uint32_t scissor_valid;
+
+        /* what the buffer is drawn into, zero falls back to the ctx viewport */
+        uint32_t viewport[2];
+
+        /*
+         * Growable buffers link chunks, each one a buffer of its own that
+         * backends draw in turn. Recording goes to the tail, state above
+         * lives in the first chunk.
+         */
+        struct nbr_cmd_buf *next;
+        struct nbr_cmd_buf *tail;
+        struct nbr_cmd_limits chunk_limits;
+        uint32_t growable;
+
+        /* recorded into caller memory with nbr_cmd_buf_init_mapped */
+        uint32_t mapped;
 };
 
 
 struct nbr_draw_data {
         struct nbr_cmd_buf **cmd_bufs;
         uint32_t cmd_buf_count;
+        uint32_t viewport[2];               /* optional, zero uses the ctx viewport */
 };
 
 
 struct nb_font_tex {
         uint8_t *mem;
         uint32_t width;
+        uint32_t height;
+        uint32_t mode;                      /* nbr_font_mode */
+        uint32_t generation;                /* bumped each time the atlas is rebaked */
 };
 
 
 struct nbi_font_range {
         uint32_t start;
         uint32_t end;
+
+        const uint8_t *ttf;
+        float scale;                        /* draw height over bake height */
+        uint32_t shared;                    /* range_data is owned by another font */
 };
 
 
 struct nbi_font {
-        struct nb_font_tex tex;
+        const struct nb_font_tex *tex;
+        const uint8_t *ttf;
 
         stbtt_packedchar *range_data[4];
         struct nbi_font_range ranges[4];
         uint32_t range_count;
+        float ascii_adv[128];               /* measuring cache, zero if not in the font */
+        uint32_t ascii_fast;                /* every printable ascii glyph is in the font */
 
         float height;
         float ascent;
+        float ascent_ratio;
         float space_width;
 };
 
 
+typedef void(*nbr_job_fn)(void *arg);
+
+
+/*
+ * Fans work out to the callers thread pool. Must call `fn(args[i])` once for
+ * every `i < count`, on any thread and in any order, and only return once all
+ * of them have completed.
+ */
+typedef void(*nbr_job_dispatch_fn)(
+        void *user_data,
+        nbr_job_fn fn,
+        void **args,
+        uint32_t count);
+
+
+struct nbr_ctx_desc {
+        nbr_job_dispatch_fn job_dispatch;   /* optional - work runs on the calling thread if null */
+        void *job_user_data;                /* optional - passed to `job_dispatch` */
+        uint32_t font_mode;                 /* optional - nbr_font_mode, defaults to bitmap */
+        uint32_t anti_alias;                /* optional - feathers box, line and curve edges, no MSAA needed */
+};
+
+
 typedef struct nb_renderer_ctx * nbr_ctx_t;
 
+struct nbi_font_file {
+        void *mem;
+        size_t size;
+};
+
+
 struct nb_renderer_ctx {
+        struct nb_font_tex atlas;
         struct nbi_font fonts[NBR_FONT_COUNT_MAX];
         uint32_t font_count;
         struct nbi_font *font;
         struct nbi_font *debug_font_next;
 
+        /* icons are baked once and every text font links to them */
+        struct nbi_font icons;
+
+        struct nbi_font_file files[NBR_FONT_COUNT_MAX];
+        uint32_t file_count;
+
+        volatile long ref_count;
+
+        uint32_t anti_alias;
+
+        /* unit quarter circles per segment count, and segment count per radius */
+        float corner_unit[NBR_CORNER_SEGMENTS_MAX + 1][NBR_CORNER_SEGMENTS_MAX + 1][4];
+        uint8_t corner_segs[256];
+
+        nbr_job_dispatch_fn job_dispatch;
+        void *job_user_data;
+
         uint32_t width, height;
 };
 
@@ -143,11 +410,39 @@ struct nb_renderer_ctx {
 /* -------------------------------------------------------------- Lifetime -- */
 
 
+/*
+ *  Bakes the font atlases, each font range is rasterized as its own job so a
+ *  `job_dispatch` in the desc can spread the work over several threads.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if out_ctx is null
+ *  returns `NB_FAIL` if an internal error occured
+ */
 nb_result
 nbr_ctx_create(
-        nbr_ctx_t *out_ctx);
+        nbr_ctx_t *out_ctx,                 /* required */
+        const struct nbr_ctx_desc *desc);   /* optional */
+
+
+/*
+ *  Adds a reference to the context, so several owners such as sugar contexts
+ *  can share one set of baked fonts. Glyph data is read only once shared and
+ *  can be used from any thread, adding fonts or changing heights fails.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx is null
+ */
+nb_result
+nbr_ctx_retain(
+        nbr_ctx_t ctx);
 
 
+/*
+ *  Drops a reference, the context is freed with the last one.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx is null
+ */
 nb_result
 nbr_ctx_destroy(
         nbr_ctx_t *c);
@@ -161,10 +456,76 @@ nb_get_font_count(
         struct nb_renderer_ctx *ctx);
 
 
+/*
+ *  All fonts share a single atlas, so a frame can mix fonts without having to
+ *  switch textures.
+ */
 nb_result
-nb_get_font_tex_list(
+nb_get_font_atlas(
         struct nb_renderer_ctx *ctx,
-        struct nb_font_tex * tex_list);
+        struct nb_font_tex *out_tex);
+
+
+/*
+ *  Adds a font from ttf data the caller keeps alive for the lifetime of the
+ *  context, such as a memory mapped file. The atlas is rebaked, so call this
+ *  outside of a frame and let the backend pick up the new generation.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx or ttf is null, or ttf is not a font
+ *  returns `NB_FAIL` if there is no room for another font
+ */
+nb_result
+nbr_font_add_memory(
+        struct nb_renderer_ctx *ctx,        /* required */
+        const uint8_t *ttf,                 /* required */
+        size_t size,
+        float height,
+        uint32_t *out_font);                /* optional */
+
+
+/*
+ *  Memory maps a ttf file and adds it as with `nbr_font_add_memory`, the
+ *  mapping is released with the context.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx or path is null, or it is not a font
+ *  returns `NB_FAIL` if the file could not be mapped or there is no room
+ */
+nb_result
+nbr_font_add_file(
+        struct nb_renderer_ctx *ctx,        /* required */
+        const char *path,                   /* required */
+        float height,
+        uint32_t *out_font);                /* optional */
+
+
+/*
+ *  Only SDF fonts can change height after creation, the glyphs are rescaled
+ *  from the shared bake so this costs nothing.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx is null or font is out of range
+ *  returns `NB_FAIL` if the atlas is not in `NBR_FONT_MODE_SDF`
+ */
+nb_result
+nbr_font_set_height(
+        struct nb_renderer_ctx *ctx,        /* required */
+        uint32_t font,
+        float height);
+
+
+/*
+ *  Reference resolve of an SDF atlas sample for software backends, this
+ *  matches the OGL3 shader. `scale` is screen pixels per atlas texel, which
+ *  is the font height over `NBR_SDF_BAKE_HEIGHT`.
+ *
+ *  returns coverage in the range 0 to 1
+ */
+float
+nbr_sdf_coverage(
+        uint8_t sample,
+        float scale);
 
 
 /* DEBUG!! */
@@ -191,6 +552,30 @@ nb_result
 nbr_cmd_buf_init(struct nbr_cmd_buf **out_buf, struct nbr_cmd_limits lim, void *mem);
 
 
+/*
+ * Records vertices and indices straight into `vtx_mem` and `idx_mem`, which
+ * can be mapped or write-combined upload memory a backend draws from without
+ * copying. They are only ever written, front to back. `mem` holds the rest
+ * and is nbr_cmd_buf_get_mapped_size bytes. Call nbr_cmd_buf_flush once
+ * recording is done and before the memory is handed to the GPU.
+ */
+uint32_t
+nbr_cmd_buf_get_mapped_size(struct nbr_cmd_limits lim);
+
+
+nb_result
+nbr_cmd_buf_init_mapped(
+        struct nbr_cmd_buf **out_buf,
+        struct nbr_cmd_limits lim,
+        void *mem,
+        struct nbr_vtx *vtx_mem,
+        nbr_idx *idx_mem);
+
+
+void
+nbr_cmd_buf_flush(struct nbr_cmd_buf *buf);
+
+
 void
 nbr_cmd_buf_clear(struct nbr_cmd_buf *buf);
 
@@ -199,6 +584,53 @@ void
 nbr_cmd_buf_array_clear(struct nbr_cmd_buf **bufs, uint32_t buf_count);
 
 
+void
+nbr_cmd_buf_get_stats(struct nbr_cmd_buf *buf, struct nbr_cmd_stats *out_stats);
+
+
+/*
+ * Growable buffers start with one chunk of `lim` and link another from
+ * NB_ALLOC whenever a primitive does not fit, sized up for primitives larger
+ * than `lim`. Chunks are kept across clears, trim frees the unused ones.
+ */
+nb_result
+nbr_cmd_buf_create(struct nbr_cmd_buf **out_buf, struct nbr_cmd_limits lim);
+
+
+void
+nbr_cmd_buf_destroy(struct nbr_cmd_buf **buf);
+
+
+void
+nbr_cmd_buf_trim(struct nbr_cmd_buf *buf);
+
+
+/*
+ * Reserves `vtx_count` vertices and `idx_count` indices of `type` for the
+ * caller to write, capacity checked once. Indices count from `base`, and
+ * vertices are set with nbr_vtx_set so they suit any vertex format. Indices
+ * are plain stores, even with NBR_VERTEX_STREAM. Custom geometry is not
+ * culled or clipped to the clip stack.
+ */
+nb_result
+nbr_cmd_reserve(
+        struct nbr_cmd_buf *buf,            /* required */
+        uint32_t type,                      /* nbr_cmd_type, triangles or lines */
+        uint32_t vtx_count,                 /* at most NBR_VERTEX_COUNT_MAX + 1 */
+        uint32_t idx_count,
+        struct nbr_cmd_reservation *out);   /* required */
+
+
+void
+nbr_vtx_set(
+        struct nbr_vtx *vtx,
+        float x,
+        float y,
+        float u,
+        float v,
+        uint32_t color);
+
+
 void
 nbr_box(
         struct nb_renderer_ctx *ctx,        /* required */
@@ -208,6 +640,36 @@ nbr_box(
         uint32_t radius);
 
 
+/*
+ * Draws a box with a border of `border` pixels around the outside of `rect`,
+ * the outer corners get `radius + border`. The fill and the border ring meet
+ * on the same inner edge so no pixel is drawn twice.
+ */
+void
+nbr_box_bordered(
+        struct nb_renderer_ctx *ctx,        /* required */
+        struct nbr_cmd_buf *buf,           /* required */
+        struct nb_rect rect,
+        uint32_t color,
+        uint32_t radius,
+        uint32_t border_color,
+        uint32_t border);
+
+
+/*
+ * Draws `count` boxes as one command after a single capacity check. `radii`
+ * may be null for sharp corners.
+ */
+void
+nbr_box_batch(
+        struct nb_renderer_ctx *ctx,        /* required */
+        struct nbr_cmd_buf *buf,           /* required */
+        const struct nb_rect *rects,       /* required */
+        const uint32_t *colors,            /* required */
+        const uint32_t *radii,             /* optional */
+        uint32_t count);
+
+
 void
 nbr_line(
         struct nb_renderer_ctx *ctx,
@@ -217,6 +679,41 @@ nbr_line(
         uint32_t color);
 
 
+/*
+ * Draws `count` lines as one command, `points` holds x0, y0, x1, y1 for each.
+ */
+void
+nbr_line_batch(
+        struct nb_renderer_ctx *ctx,        /* required */
+        struct nbr_cmd_buf *buf,           /* required */
+        const float *points,               /* required */
+        const uint32_t *colors,            /* required */
+        uint32_t count);
+
+
+enum nbr_polyline_flags {
+        NBR_POLYLINE_CLOSED = 1 << 0,       /* joins the last point back to the first */
+        NBR_POLYLINE_BEVEL = 1 << 1,        /* bevel joins, miter joins otherwise */
+        NBR_POLYLINE_TRIANGLES = 1 << 2,    /* triangles even when width is 1 or less */
+};
+
+
+/*
+ * Draws `count` points, x and y for each, as one command. Widths above 1
+ * are drawn as triangles with the joins from `flags`, thinner lines are
+ * drawn as line segments unless NBR_POLYLINE_TRIANGLES is set.
+ */
+void
+nbr_polyline(
+        struct nb_renderer_ctx *ctx,        /* required */
+        struct nbr_cmd_buf *buf,           /* required */
+        const float *points,               /* required */
+        uint32_t count,
+        uint32_t color,
+        float width,
+        uint32_t flags);
+
+
 void
 nbr_bez(
         struct nb_renderer_ctx *ctx,
@@ -228,26 +725,54 @@ nbr_bez(
         uint32_t color);
 
 
+/*
+ * The fit flags keep unwrapped lines inside the rect width, cutting with
+ * "..." at the end, cutting at the last whole glyph, or scaling the line
+ * down. Fitted sizes never report more than the width.
+ */
 enum nbr_text_flags {
         NBI_TEXT_FLAGS_CURSOR = 1 << 15,
         NBI_TEXT_FLAGS_WRAP = 1 << 14,
         NBI_TEXT_FLAGS_TERM = 1 << 13,
+        NBI_TEXT_FLAGS_ELLIPSIS = 1 << 12,
+        NBI_TEXT_FLAGS_TRUNCATE = 1 << 11,
+        NBI_TEXT_FLAGS_SHRINK = 1 << 10,
+
+        _NBI_TEXT_FLAGS_FIT_MASK = (1 << 12) | (1 << 11) | (1 << 10),
 };
 
 
 void
 nbr_get_text_size(
         struct nb_renderer_ctx * ctx,
+        uint32_t font,
         float width,
         uint32_t flags,
         const char *str,
         float *out_size);
 
 
+/*
+ *  Measures `count` strings with one font and flags, writing a width and
+ *  height pair per string to `out_sizes`. Same results as calling
+ *  `nbr_get_text_size` for each.
+ */
+void
+nbr_get_text_size_batch(
+        struct nb_renderer_ctx * ctx,
+        uint32_t font,
+        float width,
+        uint32_t flags,
+        const char **strs,
+        uint32_t count,
+        float *out_sizes);
+
+
 void
 nbr_text(
         struct nb_renderer_ctx *ctx,
         struct nbr_cmd_buf *buf,
+        uint32_t font,
         struct nb_rect pos,
         uint32_t flags,
         uint32_t color,
@@ -265,41 +790,201 @@ nbr_scissor_clear(
         struct nbr_cmd_buf *buf);
 
 
-/* ---------------------------------------------------------- Render State -- */
+/*
+ * Clip rects nest, each push is intersected with the rect below it. Text and
+ * sharp boxes without anti-aliasing are clipped on the CPU and stay in the
+ * same draw, other geometry still needs nbr_scissor_set.
+ */
+void
+nbr_clip_push(
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect);
 
 
-nb_result
-nbr_viewport_set(
-        nbr_ctx_t ctx,
-        uint32_t width,
-        uint32_t height);
+void
+nbr_clip_pop(
+        struct nbr_cmd_buf *buf);
 
 
-nb_result
-nbr_viewport_get(
-        nbr_ctx_t ctx,
-        uint32_t *width,
-        uint32_t *height);
+/*
+ * Has the backend call `fn` at this point in the buffer, for rendering of
+ * its own inside a window such as 3D previews. It runs under the current
+ * scissor and the backend sets its state up again afterwards.
+ */
+void
+nbr_callback(
+        struct nbr_cmd_buf *buf,            /* required */
+        nbr_draw_callback_fn fn,            /* required */
+        void *user_data);
 
 
-#endif
+/* ----------------------------------------------------------- Text Layout -- */
+/*
+ * A retained layout keeps its own copy of the text along with the line
+ * breaks and glyph quads, edits only relayout the paragraphs they touch.
+ * Offsets are in bytes and must be on utf8 boundaries. Destroy layouts
+ * before the ctx they were created with.
+ */
 
 
-/* ================================== IMPL ================================== */
+typedef struct nbr_text_layout * nbr_text_layout_t;
 
 
-#ifdef NEB_RENDERER_IMPL
-#ifndef NEBULA_RENDERER_IMPL_INCLUDED
-#define NEBULA_RENDERER_IMPL_INCLUDED
+/*
+ *  `flags` takes the alignment and `NBI_TEXT_FLAGS_WRAP`, `width` is the
+ *  wrap and alignment width.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx or out_layout is null
+ *  returns `NB_FAIL` if an internal error occured
+ */
+nb_result
+nbr_text_layout_create(
+        nbr_ctx_t ctx,                      /* required */
+        uint32_t font,
+        uint32_t flags,
+        float width,
+        nbr_text_layout_t *out_layout);     /* required */
+
+
+nb_result
+nbr_text_layout_destroy(
+        nbr_text_layout_t *layout);         /* required */
+
+
+/* replaces all the text */
+nb_result
+nbr_text_layout_set(
+        nbr_text_layout_t layout,           /* required */
+        const char *str,                    /* optional */
+        uint32_t len);
+
+
+nb_result
+nbr_text_layout_insert(
+        nbr_text_layout_t layout,           /* required */
+        uint32_t offset,
+        const char *str,                    /* required */
+        uint32_t len);
+
+
+nb_result
+nbr_text_layout_delete(
+        nbr_text_layout_t layout,           /* required */
+        uint32_t offset,
+        uint32_t len);
+
+
+/* paragraphs that still fit on one line are kept as they are */
+nb_result
+nbr_text_layout_set_width(
+        nbr_text_layout_t layout,           /* required */
+        float width);
+
+
+nb_result
+nbr_text_layout_get_size(
+        nbr_text_layout_t layout,           /* required */
+        float *out_size);                   /* required */
+
+
+/*
+ *  Draws the lines of the layout that fall inside `rect`, the text starts
+ *  at the top left of `rect` moved up by `scroll` pixels.
+ */
+void
+nbr_text_layout_emit(
+        nbr_text_layout_t layout,
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect,
+        int scroll,
+        uint32_t color);
+
+
+/* ---------------------------------------------------------- Render State -- */
+
+
+nb_result
+nbr_viewport_set(
+        nbr_ctx_t ctx,
+        uint32_t width,
+        uint32_t height);
+
+
+nb_result
+nbr_viewport_get(
+        nbr_ctx_t ctx,
+        uint32_t *width,
+        uint32_t *height);
+
+
+/*
+ * The viewport a buffer is drawn into, for culling while it is recorded.
+ * Buffers without one cull against the ctx viewport, if that is set, so
+ * buffers of ctxs shared between several viewports should each set theirs.
+ */
+void
+nbr_cmd_buf_set_viewport(
+        struct nbr_cmd_buf *buf,            /* required */
+        uint32_t width,
+        uint32_t height);
+
+
+#endif
+
+
+/* ================================== IMPL ================================== */
+
+
+#ifdef NEB_RENDERER_IMPL
+#ifndef NEBULA_RENDERER_IMPL_INCLUDED
+#define NEBULA_RENDERER_IMPL_INCLUDED
 
 
+#if NBR_FONT_EMBED_AWESOME
 #include "nebula_font_awesome.h"
+#endif
+
+#if NBR_FONT_EMBED_OPEN_SANS
 #include "nebula_font_open_sans.h"
+#endif
+
+#if NBR_FONT_EMBED_PROGGY
 #include "nebula_font_proggy.h"
+#endif
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
 
+#if NBR_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if NBR_VERTEX_STREAM && !NBR_SIMD_SSE2
+#error "NBR_VERTEX_STREAM needs NBR_SIMD_SSE2 for non-temporal stores"
+#endif
+
+/* streamed vertices and indices are written a word at a time by nbi_vtx_set and nbi_idx_set */
+#define NBI_VTX_STREAM (NBR_SIMD_SSE2 && NBR_VERTEX_STREAM)
+#define NBI_IDX_PER_WORD (32 / NBR_INDEX_SIZE)
+
+/* float vertices are written a whole position and uv at a time */
+#define NBI_VTX_SSE2 (NBR_SIMD_SSE2 && !NBR_VERTEX_COMPACT && !NBI_VTX_STREAM)
+
+#if NBR_FONT_FILE_SUPPORT
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
 
 /* ---------------------------------------------- Stdlib / Config / Macros -- */
 /*
@@ -332,6 +1017,29 @@ nbr_viewport_get(
 #define NB_ARR_COUNT(ARR) (sizeof((ARR)) / sizeof((ARR)[0]))
 
 
+/* both return the new value */
+#ifndef NBR_ATOMIC_INC
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NBR_ATOMIC_INC(ptr) _InterlockedIncrement((ptr))
+#define NBR_ATOMIC_DEC(ptr) _InterlockedDecrement((ptr))
+#else
+#define NBR_ATOMIC_INC(ptr) __atomic_add_fetch((ptr), 1, __ATOMIC_ACQ_REL)
+#define NBR_ATOMIC_DEC(ptr) __atomic_sub_fetch((ptr), 1, __ATOMIC_ACQ_REL)
+#endif
+#endif
+
+/* reads the value the increments and decrements leave */
+#ifndef NBR_ATOMIC_LOAD
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define NBR_ATOMIC_LOAD(ptr) _InterlockedCompareExchange((ptr), 0, 0)
+#else
+#define NBR_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#endif
+#endif
+
+
 /* ----------------------------------------------------------- Text / Font -- */
 
 
@@ -374,10 +1082,34 @@ nbi_get_glyph_quad(
 
         uint32_t range_idx = nbi_get_font_range_idx(font, cp);
         if(range_idx < font->range_count) {
+                struct nbi_font_range * range = font->ranges + range_idx;
                 stbtt_packedchar * data = font->range_data[range_idx];
-                uint32_t size = font->tex.width;
-                int glyph = (int)(cp - font->ranges[range_idx].start);
-                stbtt_GetPackedQuad(data, size, size, glyph, x, y, q, 1);
+                int width = (int)font->tex->width;
+                int height = (int)font->tex->height;
+                int glyph = (int)(cp - range->start);
+
+                if(font->tex->mode != NBR_FONT_MODE_SDF) {
+                        stbtt_GetPackedQuad(data, width, height, glyph, x, y, q, 1);
+                }
+                else {
+                        /* sdf quads scale freely, so no pixel snapping */
+                        const stbtt_packedchar * b = data + glyph;
+                        float s = range->scale;
+                        float ipw = 1.0f / (float)width;
+                        float iph = 1.0f / (float)height;
+
+                        q->x0 = *x + b->xoff * s;
+                        q->y0 = *y + b->yoff * s;
+                        q->x1 = *x + b->xoff2 * s;
+                        q->y1 = *y + b->yoff2 * s;
+
+                        q->s0 = b->x0 * ipw;
+                        q->t0 = b->y0 * iph;
+                        q->s1 = b->x1 * ipw;
+                        q->t1 = b->y1 * iph;
+
+                        *x += b->xadvance * s;
+                }
         }
 }
 
@@ -393,6 +1125,26 @@ nbi_get_glyph_width(struct nbi_font * font, uint32_t cp) {
 }
 
 
+/* same as `nbi_get_glyph_width` without building a quad */
+static float
+nbi_get_glyph_adv(struct nbi_font * font, uint32_t cp) {
+        if(cp < NB_ARR_COUNT(font->ascii_adv)) {
+                return font->ascii_adv[cp];
+        }
+
+        uint32_t range_idx = nbi_get_font_range_idx(font, cp);
+        if(range_idx < font->range_count) {
+                const stbtt_packedchar * b = font->range_data[range_idx] + (cp - font->ranges[range_idx].start);
+                if(font->tex->mode != NBR_FONT_MODE_SDF) {
+                        return b->xadvance;
+                }
+                return b->xadvance * font->ranges[range_idx].scale;
+        }
+
+        return 0.0f;
+}
+
+
 uint32_t
 nb_debug_get_font(
         struct nb_renderer_ctx * ctx)
@@ -403,7 +1155,11 @@ nb_debug_get_font(
         if(!font) {
                 font = ctx->font;
         }
-        NB_ASSERT(font);
+
+        /* no fonts, text calls skip the index */
+        if(!font) {
+                return 0;
+        }
 
         uint32_t result = (uint32_t)(font - ctx->fonts);
         NB_ASSERT(result < ctx->font_count);
@@ -411,39 +1167,283 @@ nb_debug_get_font(
 }
 
 
+/*
+ * Baking is split in two, packing the glyph rects is cheap and has to be
+ * serial, rasterizing into the packed rects is the expensive part and each
+ * range writes to its own disjoint rects, so that is what runs as a job.
+ */
+struct nbi_bake_job {
+        stbtt_pack_context stbtt;           /* copy, render mutates the oversample state */
+        stbtt_fontinfo info;
+        stbtt_pack_range range;
+        stbrp_rect *rects;
+        int rect_count;
+        uint32_t mode;
+        int result;
+};
+
+
+static void
+nbi_sdf_gather_rects(
+        stbtt_pack_context *stbtt,
+        struct nbi_bake_job *job)
+{
+        float scale = stbtt_ScaleForPixelHeight(&job->info, job->range.font_size);
+        int i;
+
+        for(i = 0; i < job->range.num_chars; i++) {
+                int cp = job->range.first_unicode_codepoint_in_range + i;
+                int glyph = stbtt_FindGlyphIndex(&job->info, cp);
+
+                int x0, y0, x1, y1;
+                stbtt_GetGlyphBitmapBoxSubpixel(&job->info, glyph, scale, scale, 0.0f, 0.0f, &x0, &y0, &x1, &y1);
+
+                /* empty glyphs get no sdf, so no space */
+                int w = 0, h = 0;
+                if(x0 != x1 && y0 != y1) {
+                        w = (x1 - x0) + (NBR_SDF_PADDING * 2);
+                        h = (y1 - y0) + (NBR_SDF_PADDING * 2);
+                }
+
+                job->rects[i].w = (stbrp_coord)(w + stbtt->padding);
+                job->rects[i].h = (stbrp_coord)(h + stbtt->padding);
+        }
+}
+
+
+static int
+nbi_sdf_render_rects(struct nbi_bake_job *job) {
+        float scale = stbtt_ScaleForPixelHeight(&job->info, job->range.font_size);
+        int result = 1;
+        int i;
+
+        for(i = 0; i < job->range.num_chars; i++) {
+                stbrp_rect *r = job->rects + i;
+                stbtt_packedchar *bc = job->range.chardata_for_range + i;
+
+                if(!r->was_packed) {
+                        result = 0;
+                        continue;
+                }
+
+                int cp = job->range.first_unicode_codepoint_in_range + i;
+                int glyph = stbtt_FindGlyphIndex(&job->info, cp);
+
+                int advance, lsb;
+                stbtt_GetGlyphHMetrics(&job->info, glyph, &advance, &lsb);
+                bc->xadvance = scale * (float)advance;
+
+                int w, h, xoff, yoff;
+                uint8_t *sdf = stbtt_GetGlyphSDF(
+                        &job->info,
+                        scale,
+                        glyph,
+                        NBR_SDF_PADDING,
+                        NBR_SDF_ONEDGE,
+                        NBR_SDF_DIST_SCALE,
+                        &w, &h, &xoff, &yoff);
+
+                if(!sdf) {
+                        continue;
+                }
+
+                int row;
+                for(row = 0; row < h; row++) {
+                        uint8_t *dst = job->stbtt.pixels + r->x + (r->y + row) * job->stbtt.stride_in_bytes;
+                        memcpy(dst, sdf + row * w, (size_t)w);
+                }
+
+                stbtt_FreeSDF(sdf, job->info.userdata);
+
+                bc->x0 = (unsigned short)r->x;
+                bc->y0 = (unsigned short)r->y;
+                bc->x1 = (unsigned short)(r->x + w);
+                bc->y1 = (unsigned short)(r->y + h);
+                bc->xoff = (float)xoff;
+                bc->yoff = (float)yoff;
+                bc->xoff2 = (float)(xoff + w);
+                bc->yoff2 = (float)(yoff + h);
+        }
+
+        return result;
+}
+
+
 static void
+nbi_bake_job_run(void *arg) {
+        struct nbi_bake_job *job = (struct nbi_bake_job *)arg;
+
+        if(job->mode == NBR_FONT_MODE_SDF) {
+                job->result = nbi_sdf_render_rects(job);
+        }
+        else {
+                job->result = stbtt_PackFontRangesRenderIntoRects(&job->stbtt, &job->info, &job->range, 1, job->rects);
+        }
+}
+
+
+/*
+ * In SDF mode a range is baked at `NBR_SDF_BAKE_HEIGHT` regardless of the
+ * requested height, so any earlier font that baked the same range from the
+ * same ttf can lend us its glyphs.
+ */
+static uint32_t
+nbi_find_shared_range(
+        struct nb_renderer_ctx *ctx,
+        struct nbi_font *font,
+        const uint8_t *ttf,
+        uint32_t start,
+        uint32_t end)
+{
+        struct nbi_font *other;
+
+        if(ctx->atlas.mode != NBR_FONT_MODE_SDF) {
+                return 0;
+        }
+
+        for(other = ctx->fonts; other < font; other++) {
+                uint32_t i;
+                for(i = 0; i < other->range_count; i++) {
+                        struct nbi_font_range *range = other->ranges + i;
+                        if(range->ttf == ttf && range->start == start && range->end == end && !range->shared) {
+                                uint32_t idx = font->range_count;
+                                font->ranges[idx].shared = 1;
+                                font->range_data[idx] = other->range_data[i];
+                                return 1;
+                        }
+                }
+        }
+
+        return 0;
+}
+
+
+static uint32_t
 nbi_push_font_range(
+        struct nb_renderer_ctx *ctx,
         struct nbi_font *font,
         stbtt_pack_context *stbtt,
-        uint8_t *ttf,
+        struct nbi_bake_job *job,
+        const uint8_t *ttf,
         uint32_t start,
         uint32_t end,
         float height)
 {
+        uint32_t job_count = 0;
+
         if(font->range_count < NB_ARR_COUNT(font->ranges)) {
-                uint32_t idx = font->range_count++;
+                uint32_t idx = font->range_count;
                 struct nbi_font_range *range = font->ranges + idx;
                 range->start = start;
                 range->end = end;
+                range->ttf = ttf;
+                range->scale = 1.0f;
+                range->shared = 0;
+
+                float bake_height = height;
+                if(ctx->atlas.mode == NBR_FONT_MODE_SDF) {
+                        bake_height = NBR_SDF_BAKE_HEIGHT;
+                        range->scale = height / bake_height;
+                }
+
+                if(nbi_find_shared_range(ctx, font, ttf, start, end)) {
+                        font->range_count++;
+                        return job_count;
+                }
+
+                font->range_count++;
 
                 uint32_t char_count = range->end - range->start;
                 font->range_data[idx] = NB_ALLOC(sizeof(stbtt_packedchar) * char_count);
-                stbtt_PackFontRange(stbtt, ttf, 0, height, range->start, char_count, font->range_data[idx]);
+                memset(font->range_data[idx], 0, sizeof(stbtt_packedchar) * char_count);
+
+                stbtt_InitFont(&job->info, ttf, 0);
+                job->range.font_size = bake_height;
+                job->range.first_unicode_codepoint_in_range = (int)start;
+                job->range.array_of_unicode_codepoints = 0;
+                job->range.num_chars = (int)char_count;
+                job->range.chardata_for_range = font->range_data[idx];
+                job->rects = NB_ALLOC(sizeof(stbrp_rect) * char_count);
+                job->mode = ctx->atlas.mode;
+                job->result = 0;
+
+                /* only measured here, the atlas size is not known yet */
+                job->rect_count = (int)char_count;
+                if(job->mode == NBR_FONT_MODE_SDF) {
+                        nbi_sdf_gather_rects(stbtt, job);
+                }
+                else {
+                        job->rect_count = stbtt_PackFontRangesGatherRects(stbtt, &job->info, &job->range, 1, job->rects);
+                }
+
+                job_count = 1;
         }
         else {
                 NB_ASSERT(!"nbi_push_font_range: font full!");
         }
+
+        return job_count;
+}
+
+
+static uint32_t
+nbi_icons_init(
+        struct nb_renderer_ctx *ctx,
+        stbtt_pack_context *stbtt,
+        struct nbi_bake_job *jobs)
+{
+        struct nbi_font *icons = &ctx->icons;
+        uint32_t job_count = 0;
+
+        icons->tex = &ctx->atlas;
+        icons->range_count = 0;
+
+#if NBR_FONT_EMBED_AWESOME
+        job_count += nbi_push_font_range(ctx, icons, stbtt, jobs + job_count, NB_FONT_AWESOME_TTF, NB_FA_CODE_MIN, NB_FA_CODE_MAX, 12.0f);
+#else
+        (void)stbtt;
+        (void)jobs;
+#endif
+
+        return job_count;
 }
 
 
+/*
+ * Text fonts borrow the icon ranges rather than baking their own copy, the
+ * glyph table is owned by `ctx->icons`.
+ */
 static void
+nbi_font_link_icons(
+        struct nb_renderer_ctx *ctx,
+        struct nbi_font *font)
+{
+        uint32_t i;
+        for(i = 0; i < ctx->icons.range_count; i++) {
+                if(font->range_count >= NB_ARR_COUNT(font->ranges)) {
+                        NB_ASSERT(!"nbi_font_link_icons: font full!");
+                        break;
+                }
+
+                uint32_t idx = font->range_count++;
+                font->ranges[idx] = ctx->icons.ranges[i];
+                font->ranges[idx].shared = 1;
+                font->range_data[idx] = ctx->icons.range_data[i];
+        }
+}
+
+
+static uint32_t
 nbi_font_init(
+        struct nb_renderer_ctx *ctx,
         struct nbi_font *font,
-        uint8_t *ttf,
-        float height)
+        stbtt_pack_context *stbtt,
+        struct nbi_bake_job *jobs)
 {
-        font->tex.width = 512;
-        font->tex.mem = NB_ALLOC(font->tex.width * font->tex.width);
+        const uint8_t *ttf = font->ttf;
+        float height = font->height;
+
+        font->tex = &ctx->atlas;
 
         stbtt_fontinfo info;
         stbtt_InitFont(&info, ttf, 0);
@@ -451,761 +1451,4386 @@ nbi_font_init(
         int ascent, descent, line_gap;
         stbtt_GetFontVMetrics(&info, &ascent, &descent, &line_gap);
 
-        float scale = stbtt_ScaleForPixelHeight(&info, height);
-
-        font->height = height;
-        font->ascent = scale * (float)ascent;
+        font->ascent_ratio = (float)ascent / (float)(ascent - descent);
+        font->ascent = height * font->ascent_ratio;
 
-        stbtt_pack_context stbtt;
-        stbtt_PackBegin(&stbtt, font->tex.mem, font->tex.width, font->tex.width, font->tex.width, 1, 0);
-        /*stbtt_PackSetOversampling(&stbtt, 2, 2);*/
+        uint32_t job_count = 0;
 
         font->range_count = 0;
-        nbi_push_font_range(font, &stbtt, ttf, 32, 127, height);
-        nbi_push_font_range(font, &stbtt, NB_FONT_AWESOME_TTF, NB_FA_CODE_MIN, NB_FA_CODE_MAX, 12.0f);
+        job_count += nbi_push_font_range(ctx, font, stbtt, jobs + job_count, ttf, 32, 127, height);
 
-        stbtt_PackEnd(&stbtt);
+        nbi_font_link_icons(ctx, font);
 
-        font->space_width = nbi_get_glyph_width(font, ' ');
+        return job_count;
 }
 
 
-/* -------------------------------------------------------- Mesh Resources -- */
-
-
 static void
-nbi_push_vtx_uv(
-        struct nbr_vtx_buf *buf,
-        float x,
-        float y,
-        float u,
-        float v,
-        uint32_t c)
-{
-        if(buf->vtx_count < buf->vtx_count_max) {
-                uint32_t i = buf->vtx_count++;
-                buf->vtx[i].x = x;
-                buf->vtx[i].y = y;
-                buf->vtx[i].u = u;
-                buf->vtx[i].v = v;
-                buf->vtx[i].c = c;
-        }
-        else {
-                NB_ASSERT(!"nbi_push_vtx_uv: vtx buf full!");
+nbi_font_cache_advances(struct nbi_font *font) {
+        uint32_t c;
+        font->ascii_fast = 1;
+
+        for(c = 0; c < NB_ARR_COUNT(font->ascii_adv); c++) {
+                font->ascii_adv[c] = nbi_get_glyph_width(font, c);
+                if(c > ' ' && c < 0x7F && !nbi_char_valid(font, c)) {
+                        font->ascii_fast = 0;
+                }
         }
+
+        font->space_width = font->ascii_adv[' '];
 }
 
 
 static void
-nbi_push_vtx(
-        struct nbr_vtx_buf *buf,
-        float x,
-        float y,
-        uint32_t c)
-{
-        nbi_push_vtx_uv(buf, x, y, 0.0f, 0.0f, c);
+nbi_font_init_end(struct nbi_font *font) {
+        nbi_font_cache_advances(font);
 }
 
 
-static void
-nbi_push_idx(struct nbr_vtx_buf *buf, nbr_idx idx) {
-        if(buf->idx_count < buf->idx_count_max) {
-                buf->idx[buf->idx_count++] = idx;
+nb_result
+nbr_font_set_height(
+        struct nb_renderer_ctx *ctx,
+        uint32_t font_idx,
+        float height)
+{
+        if(!ctx || font_idx >= ctx->font_count || height <= 0.0f) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
         }
-        else {
-                NB_ASSERT(!"nbi_push_idx: vtx buf full!");
+
+        if(ctx->atlas.mode != NBR_FONT_MODE_SDF || NBR_ATOMIC_LOAD(&ctx->ref_count) > 1) {
+                return NB_FAIL;
         }
-}
 
-static void
-nbi_push_quad_idxs(
+        /* only the text range follows the font, icons keep their height */
+        struct nbi_font *font = ctx->fonts + font_idx;
+        font->ranges[0].scale = height / NBR_SDF_BAKE_HEIGHT;
+        font->height = height;
+        font->ascent = height * font->ascent_ratio;
+        nbi_font_cache_advances(font);
+
+        return NB_OK;
+}
+
+
+float
+nbr_sdf_coverage(
+        uint8_t sample,
+        float scale)
+{
+        /* texels from the edge, then screen pixels, then a one pixel ramp */
+        float dist = ((float)sample - (float)NBR_SDF_ONEDGE) / NBR_SDF_DIST_SCALE;
+        float result = dist * scale + 0.5f;
+
+        if(result < 0.0f) {
+                result = 0.0f;
+        }
+        else if(result > 1.0f) {
+                result = 1.0f;
+        }
+
+        return result;
+}
+
+
+static void
+nbi_font_release(struct nbi_font *font) {
+        uint32_t j;
+        for(j = 0; j < font->range_count; j++) {
+                if(!font->ranges[j].shared && font->range_data[j]) {
+                        NB_FREE(font->range_data[j]);
+                }
+                font->range_data[j] = 0;
+        }
+        font->range_count = 0;
+}
+
+
+static void
+nbi_atlas_release(struct nb_renderer_ctx *ctx) {
+        uint32_t i;
+        for(i = 0; i < ctx->font_count; i++) {
+                nbi_font_release(ctx->fonts + i);
+        }
+        nbi_font_release(&ctx->icons);
+
+        if(ctx->atlas.mem) {
+                NB_FREE(ctx->atlas.mem);
+                ctx->atlas.mem = 0;
+        }
+}
+
+
+/*
+ * Packs every job's rects into a `width` by `height` atlas, returns 0 if any
+ * of them did not fit. Leaves `stbtt` begun on success.
+ */
+static int
+nbi_atlas_try_pack(
+        stbtt_pack_context *stbtt,
+        uint8_t *mem,
+        uint32_t width,
+        uint32_t height,
+        struct nbi_bake_job *jobs,
+        uint32_t job_count)
+{
+        if(!stbtt_PackBegin(stbtt, mem, (int)width, (int)height, 0, 1, 0)) {
+                return 0;
+        }
+
+        uint32_t i;
+        int j;
+
+        for(i = 0; i < job_count; i++) {
+                struct nbi_bake_job *job = jobs + i;
+                stbtt_PackFontRangesPackRects(stbtt, job->rects, job->rect_count);
+
+                for(j = 0; j < job->rect_count; j++) {
+                        if(!job->rects[j].was_packed) {
+                                stbtt_PackEnd(stbtt);
+                                return 0;
+                        }
+                }
+        }
+
+        return 1;
+}
+
+
+/*
+ * (Re)bakes every font into a fresh atlas, the generation is bumped so
+ * backends know to upload the texture again.
+ *
+ * Glyph rects are measured first, then packed into power of two sizes from
+ * `NBR_ATLAS_SIZE_MIN` up, trying width by half width before going square,
+ * so the atlas is the smallest one the fonts fit in.
+ */
+static nb_result
+nbi_atlas_build(struct nb_renderer_ctx *ctx) {
+        nbi_atlas_release(ctx);
+
+        uint32_t job_count_max = (ctx->font_count + 1) * NB_ARR_COUNT(ctx->fonts[0].ranges);
+
+        struct nbi_bake_job *jobs = NB_ALLOC(sizeof(*jobs) * job_count_max);
+        void **job_args = NB_ALLOC(sizeof(*job_args) * job_count_max);
+
+        stbtt_pack_context stbtt;
+        uint32_t job_count = 0;
+        uint32_t i;
+
+        if(!jobs || !job_args) {
+                NB_ASSERT(!"nbi_atlas_build: failed to allocate");
+                goto ATLAS_CLEANUP_AND_FAIL;
+        }
+
+        /* measure, the pack context only provides padding and oversampling */
+        if(!stbtt_PackBegin(&stbtt, 0, NBR_ATLAS_SIZE_MAX, NBR_ATLAS_SIZE_MAX, 0, 1, 0)) {
+                goto ATLAS_CLEANUP_AND_FAIL;
+        }
+        /*stbtt_PackSetOversampling(&stbtt, 2, 2);*/
+
+        /* icons first, text fonts link to their glyph tables */
+        job_count += nbi_icons_init(ctx, &stbtt, jobs);
+
+        for(i = 0; i < ctx->font_count; i++) {
+                job_count += nbi_font_init(ctx, ctx->fonts + i, &stbtt, jobs + job_count);
+        }
+
+        stbtt_PackEnd(&stbtt);
+
+        /* find the smallest atlas that fits */
+        uint32_t width = 0, height = 0;
+        uint32_t w;
+
+        for(w = NBR_ATLAS_SIZE_MIN; w <= NBR_ATLAS_SIZE_MAX && !width; w *= 2) {
+                uint32_t h;
+                for(h = w / 2; h <= w; h *= 2) {
+                        if(nbi_atlas_try_pack(&stbtt, 0, w, h, jobs, job_count)) {
+                                stbtt_PackEnd(&stbtt);
+                                width = w;
+                                height = h;
+                                break;
+                        }
+                }
+        }
+
+        if(!width) {
+                NB_ASSERT(!"nbi_atlas_build: glyphs do not fit NBR_ATLAS_SIZE_MAX");
+                goto ATLAS_CLEANUP_AND_FAIL;
+        }
+
+        ctx->atlas.width = width;
+        ctx->atlas.height = height;
+        ctx->atlas.mem = NB_ALLOC(width * height);
+
+        if(!ctx->atlas.mem) {
+                NB_ASSERT(!"nbi_atlas_build: failed to allocate");
+                goto ATLAS_CLEANUP_AND_FAIL;
+        }
+
+        /* the packer is deterministic, so this lands where the measure did */
+        if(!nbi_atlas_try_pack(&stbtt, ctx->atlas.mem, width, height, jobs, job_count)) {
+                NB_ASSERT(!"nbi_atlas_build: repack failed");
+                goto ATLAS_CLEANUP_AND_FAIL;
+        }
+
+        /* rasterize */
+        for(i = 0; i < job_count; i++) {
+                jobs[i].stbtt = stbtt;
+                job_args[i] = jobs + i;
+        }
+
+        if(ctx->job_dispatch) {
+                ctx->job_dispatch(ctx->job_user_data, nbi_bake_job_run, job_args, job_count);
+        }
+        else {
+                for(i = 0; i < job_count; i++) {
+                        nbi_bake_job_run(job_args[i]);
+                }
+        }
+
+        stbtt_PackEnd(&stbtt);
+
+        int baked = 1;
+        for(i = 0; i < job_count; i++) {
+                baked &= jobs[i].result ? 1 : 0;
+                NB_FREE(jobs[i].rects);
+        }
+
+        NB_FREE(jobs);
+        NB_FREE(job_args);
+
+        if(!baked) {
+                NB_ASSERT(!"nbi_atlas_build: failed to render glyphs");
+                nbi_atlas_release(ctx);
+                return NB_FAIL;
+        }
+
+        for(i = 0; i < ctx->font_count; i++) {
+                nbi_font_init_end(ctx->fonts + i);
+        }
+
+        ctx->atlas.generation += 1;
+
+        return NB_OK;
+
+        ATLAS_CLEANUP_AND_FAIL:
+
+        if(jobs) {
+                for(i = 0; i < job_count; i++) {
+                        NB_FREE(jobs[i].rects);
+                }
+                NB_FREE(jobs);
+        }
+        if(job_args) {
+                NB_FREE(job_args);
+        }
+
+        nbi_atlas_release(ctx);
+        return NB_FAIL;
+}
+
+
+static nb_result
+nbi_font_push(
+        struct nb_renderer_ctx *ctx,
+        const uint8_t *ttf,
+        float height)
+{
+        if(ctx->font_count >= NB_ARR_COUNT(ctx->fonts)) {
+                NB_ASSERT(!"More Fonts that storage, increase size");
+                return NB_FAIL;
+        }
+
+        struct nbi_font *font = ctx->fonts + ctx->font_count++;
+        NB_ZERO_MEM(font);
+        font->ttf = ttf;
+        font->height = height;
+
+        return NB_OK;
+}
+
+
+nb_result
+nbr_font_add_memory(
+        struct nb_renderer_ctx *ctx,
+        const uint8_t *ttf,
+        size_t size,
+        float height,
+        uint32_t *out_font)
+{
+        if(!ctx || !ttf || height <= 0.0f) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        /* other owners may be reading the glyph data */
+        if(NBR_ATOMIC_LOAD(&ctx->ref_count) > 1) {
+                NB_ASSERT(!"Fonts can't be added to a shared ctx");
+                return NB_FAIL;
+        }
+
+        /* smallest sfnt header, stbtt does no bounds checks past this */
+        stbtt_fontinfo info;
+        if(size < 12 || !stbtt_InitFont(&info, ttf, 0)) {
+                return NB_INVALID_PARAMS;
+        }
+
+        if(nbi_font_push(ctx, ttf, height) != NB_OK) {
+                return NB_FAIL;
+        }
+
+        /* keep the current glyphs and atlas until the new one is built */
+        uint32_t old_count = ctx->font_count - 1;
+        struct nbi_font *old_fonts = NB_ALLOC(sizeof(*old_fonts) * (old_count + 1));
+        struct nb_font_tex old_atlas = ctx->atlas;
+        uint32_t i;
+
+        if(!old_fonts) {
+                NB_ASSERT(!"NB_FAIL");
+                ctx->font_count -= 1;
+                return NB_FAIL;
+        }
+
+        memcpy(old_fonts, ctx->fonts, sizeof(*old_fonts) * old_count);
+        old_fonts[old_count] = ctx->icons;
+
+        for(i = 0; i <= old_count; i++) {
+                struct nbi_font *font = i < old_count ? ctx->fonts + i : &ctx->icons;
+                memset(font->range_data, 0, sizeof(font->range_data));
+                font->range_count = 0;
+        }
+        ctx->atlas.mem = 0;
+
+        if(nbi_atlas_build(ctx) != NB_OK) {
+                /* the failed build released its own glyphs */
+                ctx->font_count = old_count;
+                memcpy(ctx->fonts, old_fonts, sizeof(*old_fonts) * old_count);
+                ctx->icons = old_fonts[old_count];
+                ctx->atlas = old_atlas;
+                NB_FREE(old_fonts);
+                return NB_FAIL;
+        }
+
+        for(i = 0; i <= old_count; i++) {
+                nbi_font_release(old_fonts + i);
+        }
+        if(old_atlas.mem) {
+                NB_FREE(old_atlas.mem);
+        }
+        NB_FREE(old_fonts);
+
+        /* first font of a ctx created without any */
+        if(!ctx->font) {
+                ctx->font = ctx->fonts;
+        }
+
+        if(out_font) {
+                *out_font = ctx->font_count - 1;
+        }
+
+        return NB_OK;
+}
+
+
+static nb_result
+nbi_file_map(
+        const char *path,
+        struct nbi_font_file *out_file)
+{
+#if !NBR_FONT_FILE_SUPPORT
+        (void)path;
+        (void)out_file;
+        return NB_FAIL;
+#elif defined(_WIN32)
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+        if(file == INVALID_HANDLE_VALUE) {
+                return NB_FAIL;
+        }
+
+        LARGE_INTEGER size;
+        HANDLE map = 0;
+        void *mem = 0;
+
+        if(GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+                map = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        }
+        if(map) {
+                mem = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(map);
+        }
+        CloseHandle(file);
+
+        if(!mem) {
+                return NB_FAIL;
+        }
+
+        out_file->mem = mem;
+        out_file->size = (size_t)size.QuadPart;
+        return NB_OK;
+#else
+        int fd = open(path, O_RDONLY);
+        if(fd < 0) {
+                return NB_FAIL;
+        }
+
+        struct stat st;
+        void *mem = MAP_FAILED;
+
+        if(fstat(fd, &st) == 0 && st.st_size > 0) {
+                mem = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+
+        if(mem == MAP_FAILED) {
+                return NB_FAIL;
+        }
+
+        out_file->mem = mem;
+        out_file->size = (size_t)st.st_size;
+        return NB_OK;
+#endif
+}
+
+
+static void
+nbi_file_unmap(struct nbi_font_file *file) {
+#if !NBR_FONT_FILE_SUPPORT
+        (void)file;
+#elif defined(_WIN32)
+        UnmapViewOfFile(file->mem);
+#else
+        munmap(file->mem, file->size);
+#endif
+        file->mem = 0;
+        file->size = 0;
+}
+
+
+nb_result
+nbr_font_add_file(
+        struct nb_renderer_ctx *ctx,
+        const char *path,
+        float height,
+        uint32_t *out_font)
+{
+        if(!ctx || !path || height <= 0.0f) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        if(ctx->file_count >= NB_ARR_COUNT(ctx->files)) {
+                NB_ASSERT(!"More font files than storage, increase size");
+                return NB_FAIL;
+        }
+
+        struct nbi_font_file *file = ctx->files + ctx->file_count;
+        if(nbi_file_map(path, file) != NB_OK) {
+                return NB_FAIL;
+        }
+
+        nb_result result = nbr_font_add_memory(ctx, (const uint8_t *)file->mem, file->size, height, out_font);
+        if(result == NB_OK) {
+                ctx->file_count += 1;
+        }
+        else {
+                nbi_file_unmap(file);
+        }
+
+        return result;
+}
+
+
+/* -------------------------------------------------------- Mesh Resources -- */
+
+
+#if NBR_VERTEX_COMPACT
+static int16_t
+nbi_vtx_fixed(float x) {
+        float f = x * (float)NBR_VERTEX_SUBPIXELS;
+        f = f < -32768.0f ? -32768.0f : (f > 32767.0f ? 32767.0f : f);
+        return (int16_t)(f < 0.0f ? f - 0.5f : f + 0.5f);
+}
+#endif
+
+
+/* vertices are only ever written, so mapped memory never has to be read */
+static void
+nbi_vtx_set(
+        struct nbr_vtx *vtx,
+        float x,
+        float y,
+        float u,
+        float v,
+        uint32_t c)
+{
+        struct nbr_vtx result;
+#if NBR_VERTEX_COMPACT
+        result.x = nbi_vtx_fixed(x);
+        result.y = nbi_vtx_fixed(y);
+        result.u = (uint16_t)(u * 65535.0f + 0.5f);
+        result.v = (uint16_t)(v * 65535.0f + 0.5f);
+#else
+        result.x = x;
+        result.y = y;
+        result.u = u;
+        result.v = v;
+#endif
+        result.c = c;
+
+#if NBI_VTX_STREAM
+        int words[sizeof(result) / sizeof(int)];
+        memcpy(words, &result, sizeof(result));
+
+        uint32_t i;
+        for(i = 0; i < NB_ARR_COUNT(words); i++) {
+                _mm_stream_si32((int *)vtx + i, words[i]);
+        }
+#else
+        *vtx = result;
+#endif
+}
+
+
+static void
+nbi_push_vtx_uv(
         struct nbr_vtx_buf *buf,
-        nbr_idx top_lft,
-        nbr_idx bot_lft,
-        nbr_idx bot_rgt,
-        nbr_idx top_rgt)
+        float x,
+        float y,
+        float u,
+        float v,
+        uint32_t c)
+{
+        if(buf->vtx_count < buf->vtx_count_max) {
+                nbi_vtx_set(buf->vtx + buf->vtx_count++, x, y, u, v, c);
+        }
+        else {
+                NB_ASSERT(!"nbi_push_vtx_uv: vtx buf full!");
+        }
+}
+
+
+static void
+nbi_push_vtx(
+        struct nbr_vtx_buf *buf,
+        float x,
+        float y,
+        uint32_t c)
+{
+        nbi_push_vtx_uv(buf, x, y, 0.0f, 0.0f, c);
+}
+
+
+/*
+ * Indices are only ever written too. Streamed ones narrower than a word are
+ * gathered until the word is whole, the rest of a word the caller of
+ * nbr_cmd_reserve started is stored as is.
+ */
+static void
+nbi_idx_set(struct nbr_vtx_buf *buf, nbr_idx *idx, nbr_idx value) {
+#if NBI_VTX_STREAM
+        uint32_t at = (uint32_t)(idx - buf->idx);
+        uint32_t slot = at % NBI_IDX_PER_WORD;
+
+        if(slot && buf->idx_word_end != at) {
+                *idx = value;
+                return;
+        }
+
+        buf->idx_word = (slot ? buf->idx_word : 0) | ((uint32_t)value << (slot * NBR_INDEX_SIZE));
+        buf->idx_word_end = at + 1;
+
+        if(slot == NBI_IDX_PER_WORD - 1) {
+                _mm_stream_si32((int *)(idx - slot), (int)buf->idx_word);
+        }
+#else
+        (void)buf;
+        *idx = value;
+#endif
+}
+
+
+/* writes out a word of streamed indices that is still filling, so every command is whole in memory */
+static void
+nbi_idx_flush(struct nbr_vtx_buf *buf) {
+#if NBI_VTX_STREAM
+        uint32_t slot = buf->idx_word_end % NBI_IDX_PER_WORD;
+        if(!slot || buf->idx_word_end != buf->idx_count) {
+                return;
+        }
+
+        /* the next indices stream the word again, unless it runs past the end */
+        nbr_idx *word = buf->idx + buf->idx_count - slot;
+        if(buf->idx_count - slot + NBI_IDX_PER_WORD <= buf->idx_count_max) {
+                _mm_stream_si32((int *)word, (int)buf->idx_word);
+                return;
+        }
+
+        uint32_t i;
+        for(i = 0; i < slot; i++) {
+                word[i] = (nbr_idx)(buf->idx_word >> (i * NBR_INDEX_SIZE));
+        }
+#else
+        (void)buf;
+#endif
+}
+
+
+static void
+nbi_push_idx(struct nbr_vtx_buf *buf, nbr_idx idx) {
+        if(buf->idx_count < buf->idx_count_max) {
+                nbi_idx_set(buf, buf->idx + buf->idx_count, idx);
+                buf->idx_count += 1;
+        }
+        else {
+                NB_ASSERT(!"nbi_push_idx: vtx buf full!");
+        }
+}
+
+static void
+nbi_push_quad_idxs(
+        struct nbr_vtx_buf *buf,
+        nbr_idx top_lft,
+        nbr_idx bot_lft,
+        nbr_idx bot_rgt,
+        nbr_idx top_rgt)
+{
+        if((buf->idx_count + 6) <= buf->idx_count_max) {
+                nbr_idx *idx = buf->idx + buf->idx_count;
+                nbi_idx_set(buf, idx + 0, top_lft);
+                nbi_idx_set(buf, idx + 1, bot_lft);
+                nbi_idx_set(buf, idx + 2, bot_rgt);
+
+                nbi_idx_set(buf, idx + 3, top_lft);
+                nbi_idx_set(buf, idx + 4, bot_rgt);
+                nbi_idx_set(buf, idx + 5, top_rgt);
+                buf->idx_count += 6;
+        }
+        else {
+                NB_ASSERT(!"nbi_push_quad_idxs: vtx buf full!");
+        }
+}
+
+static nbr_idx
+nbi_push_quad(
+        struct nbr_vtx_buf *buf,
+        nbr_idx vtx,
+        float *rect,
+        uint32_t color)
+{
+        nbi_push_quad_idxs(buf, vtx, vtx + 1, vtx + 2, vtx + 3);
+        nbi_push_vtx(buf, rect[0], rect[1], color);
+        nbi_push_vtx(buf, rect[0], rect[1] + rect[3], color);
+        nbi_push_vtx(buf, rect[0] + rect[2], rect[1] + rect[3], color);
+        nbi_push_vtx(buf, rect[0] + rect[2], rect[1], color);
+        return 4;
+}
+
+/*
+ * Builds the unit quarter circle for every segment count, and picks the
+ * segment count for each radius from the chord tolerance.
+ */
+static void
+nbi_corners_init(struct nb_renderer_ctx *ctx) {
+        uint32_t n, k;
+        for(n = 1; n <= NBR_CORNER_SEGMENTS_MAX; n++) {
+                float d_angle = ((float)NB_TAU * 0.25f) / (float)n;
+                for(k = 0; k <= n; k++) {
+                        float *p = ctx->corner_unit[n][k];
+                        p[0] = k == n ? 0.0f : cosf(d_angle * (float)k);
+                        p[1] = k == n ? 1.0f : sinf(d_angle * (float)k);
+                        p[2] = 0.0f;
+                        p[3] = 0.0f;
+                }
+        }
+
+        uint32_t r;
+        ctx->corner_segs[0] = 0;
+        for(r = 1; r < NB_ARR_COUNT(ctx->corner_segs); r++) {
+                float x = 1.0f - NBR_CORNER_TOLERANCE / (float)r;
+                float seg_angle = x > -1.0f ? 2.0f * acosf(x) : (float)NB_TAU * 0.5f;
+                float segs = ceilf(((float)NB_TAU * 0.25f) / seg_angle);
+                ctx->corner_segs[r] = segs < (float)NBR_CORNER_SEGMENTS_MAX ? (uint8_t)segs : NBR_CORNER_SEGMENTS_MAX;
+        }
+}
+
+
+uint32_t
+nb_get_font_count(
+        struct nb_renderer_ctx * ctx)
+{
+        NB_ASSERT(ctx);
+        return ctx->font_count;
+}
+
+nb_result
+nb_get_font_atlas(
+        struct nb_renderer_ctx * ctx,
+        struct nb_font_tex * out_tex)
+{
+        NB_ASSERT(ctx);
+        NB_ASSERT(out_tex);
+
+        *out_tex = ctx->atlas;
+
+        return NB_OK;
+}
+
+
+/* null when the ctx has no fonts, text is then skipped */
+static struct nbi_font *
+nbi_font_get(
+        struct nb_renderer_ctx *ctx,
+        uint32_t font)
+{
+        if(!ctx->font_count) {
+                return 0;
+        }
+
+        if(font >= ctx->font_count) {
+                NB_ASSERT(!"nbi_font_get: invalid font idx");
+                font = 0;
+        }
+        return ctx->fonts + font;
+}
+
+
+static uint32_t
+nbi_decode_utf8_cp(
+        char *utf8,
+        uint32_t *cp)
+{
+        *cp = 0;
+
+        uint8_t *it = (uint8_t *)utf8;
+        uint8_t byte = *it++;
+        if((byte & 0x80) == 0) {
+                *cp = (uint32_t)byte;
+        }
+        else if((byte & 0xE0) == 0xC0) {
+                *cp =  (byte  & 0x1F) << 6;
+                *cp |= (*it++ & 0x3F);
+        }
+        else if((byte & 0xF0) == 0xE0) {
+                *cp =  (byte  & 0x0F) << 12;
+                *cp |= (*it++ & 0x3F) << 6;
+                *cp |= (*it++ & 0x3F);
+        }
+        else if((byte & 0xF8) == 0xF0) {
+                *cp =  (byte  & 0x07) << 18;
+                *cp |= (*it++ & 0x3F) << 12;
+                *cp |= (*it++ & 0x3F) << 6;
+                *cp |= (*it++ & 0x3F);
+        }
+
+        uint32_t result = (uint32_t)((char *)it - utf8);
+        return result;
+}
+
+
+/* ------------------------------------------------------------- Clipping -- */
+
+
+static const struct nb_rect *
+nbi_clip_top(const struct nbr_cmd_buf *buf) {
+        return buf && buf->clip_count ? buf->clip_stack + buf->clip_count - 1 : 0;
+}
+
+
+/* intersects `rect` with `clip`, returns 0 when nothing is left */
+static int
+nbi_clip_rect(const struct nb_rect *clip, struct nb_rect *rect) {
+        int x0 = rect->x > clip->x ? rect->x : clip->x;
+        int y0 = rect->y > clip->y ? rect->y : clip->y;
+        int x1 = rect->x + rect->w < clip->x + clip->w ? rect->x + rect->w : clip->x + clip->w;
+        int y1 = rect->y + rect->h < clip->y + clip->h ? rect->y + rect->h : clip->y + clip->h;
+
+        rect->x = x0;
+        rect->y = y0;
+        rect->w = x1 > x0 ? x1 - x0 : 0;
+        rect->h = y1 > y0 ? y1 - y0 : 0;
+        return rect->w > 0 && rect->h > 0;
+}
+
+
+/*
+ * Pushes a glyph quad moved along x by `dx`, cut to `clip` when there is one
+ * with its uvs moved along. Returns the vertices pushed, none for a glyph
+ * clipped away.
+ */
+static nbr_idx
+nbi_push_glyph(
+        struct nbr_vtx_buf *data,
+        nbr_idx vtx,
+        const stbtt_aligned_quad *q,
+        float dx,
+        const struct nb_rect *clip,
+        uint32_t color)
+{
+        float x0 = q->x0 + dx;
+        float y0 = q->y0;
+        float x1 = q->x1 + dx;
+        float y1 = q->y1;
+        float u0 = q->s0;
+        float v0 = q->t0;
+        float u1 = q->s1;
+        float v1 = q->t1;
+
+        if(clip) {
+                float cx0 = (float)clip->x;
+                float cy0 = (float)clip->y;
+                float cx1 = cx0 + (float)clip->w;
+                float cy1 = cy0 + (float)clip->h;
+
+                if(x0 < cx0 || y0 < cy0 || x1 > cx1 || y1 > cy1) {
+                        float kx0 = x0 > cx0 ? x0 : cx0;
+                        float ky0 = y0 > cy0 ? y0 : cy0;
+                        float kx1 = x1 < cx1 ? x1 : cx1;
+                        float ky1 = y1 < cy1 ? y1 : cy1;
+
+                        if(kx1 <= kx0 || ky1 <= ky0) {
+                                return 0;
+                        }
+
+                        float su = (u1 - u0) / (x1 - x0);
+                        float sv = (v1 - v0) / (y1 - y0);
+                        float ku0 = u0 + (kx0 - x0) * su;
+                        float ku1 = u0 + (kx1 - x0) * su;
+                        float kv0 = v0 + (ky0 - y0) * sv;
+                        float kv1 = v0 + (ky1 - y0) * sv;
+
+                        x0 = kx0; y0 = ky0; x1 = kx1; y1 = ky1;
+                        u0 = ku0; v0 = kv0; u1 = ku1; v1 = kv1;
+                }
+        }
+
+        nbi_push_quad_idxs(data, vtx, vtx + 1, vtx + 2, vtx + 3);
+        nbi_push_vtx_uv(data, x0, y0, u0, v0, color);
+        nbi_push_vtx_uv(data, x0, y1, u0, v1, color);
+        nbi_push_vtx_uv(data, x1, y1, u1, v1, color);
+        nbi_push_vtx_uv(data, x1, y0, u1, v0, color);
+        return 4;
+}
+
+
+/* -------------------------------------------------------------- Culling -- */
+
+
+/*
+ * The area geometry has to touch to be seen: the viewport, the scissor it
+ * is recorded under and, for geometry the clip stack clips, the top clip.
+ * Primitives test their bounds against it before making any vertices. The
+ * viewport is the buffer's, or the ctx's when the buffer has none.
+ */
+struct nbi_cull {
+        float x0, y0;
+        float x1, y1;
+        uint32_t active;
+};
+
+
+static void
+nbi_cull_init(
+        struct nb_renderer_ctx *ctx,
+        const struct nbr_cmd_buf *buf,
+        uint32_t clipped,
+        struct nbi_cull *cull)
+{
+        cull->x0 = -1e30f;
+        cull->y0 = -1e30f;
+        cull->x1 = 1e30f;
+        cull->y1 = 1e30f;
+        cull->active = 0;
+
+        struct nb_rect rects[3];
+        uint32_t count = 0;
+
+        uint32_t vp_width = 0;
+        uint32_t vp_height = 0;
+
+        if(buf && buf->viewport[0] && buf->viewport[1]) {
+                vp_width = buf->viewport[0];
+                vp_height = buf->viewport[1];
+        }
+        else if(ctx) {
+                vp_width = ctx->width;
+                vp_height = ctx->height;
+        }
+
+        if(vp_width && vp_height) {
+                rects[count].x = 0;
+                rects[count].y = 0;
+                rects[count].w = (int)vp_width;
+                rects[count].h = (int)vp_height;
+                count++;
+        }
+
+        if(buf && buf->scissor_valid) {
+                rects[count].x = buf->scissor[0];
+                rects[count].y = buf->scissor[1];
+                rects[count].w = buf->scissor[2];
+                rects[count].h = buf->scissor[3];
+                count++;
+        }
+
+        const struct nb_rect *clip = nbi_clip_top(buf);
+        if(clipped && clip) {
+                rects[count++] = *clip;
+        }
+
+        uint32_t i;
+        for(i = 0; i < count; i++) {
+                float x0 = (float)rects[i].x;
+                float y0 = (float)rects[i].y;
+                float x1 = x0 + (float)rects[i].w;
+                float y1 = y0 + (float)rects[i].h;
+
+                cull->x0 = x0 > cull->x0 ? x0 : cull->x0;
+                cull->y0 = y0 > cull->y0 ? y0 : cull->y0;
+                cull->x1 = x1 < cull->x1 ? x1 : cull->x1;
+                cull->y1 = y1 < cull->y1 ? y1 : cull->y1;
+        }
+
+        cull->active = count > 0;
+}
+
+
+/* whether bounds, padded by `pad` pixels, miss the visible area */
+static int
+nbi_culled(
+        const struct nbi_cull *cull,
+        float x0,
+        float y0,
+        float x1,
+        float y1,
+        float pad)
+{
+        return cull->active &&
+                (x1 + pad <= cull->x0 || x0 - pad >= cull->x1 ||
+                y1 + pad <= cull->y0 || y0 - pad >= cull->y1);
+}
+
+
+static int
+nbi_culled_rect(const struct nbi_cull *cull, struct nb_rect rect, float pad) {
+        float x0 = (float)rect.x;
+        float y0 = (float)rect.y;
+        return nbi_culled(cull, x0, y0, x0 + (float)rect.w, y0 + (float)rect.h, pad);
+}
+
+
+static int
+nbi_culled_segment(const struct nbi_cull *cull, const float *p, const float *q, float pad) {
+        return nbi_culled(cull,
+                p[0] < q[0] ? p[0] : q[0], p[1] < q[1] ? p[1] : q[1],
+                p[0] > q[0] ? p[0] : q[0], p[1] > q[1] ? p[1] : q[1],
+                pad);
+}
+
+
+/* bounds of `count` points, x and y interleaved */
+static void
+nbi_points_bounds(const float *points, uint32_t count, float *bounds) {
+        bounds[0] = bounds[2] = points[0];
+        bounds[1] = bounds[3] = points[1];
+
+        uint32_t i;
+        for(i = 1; i < count; i++) {
+                float x = points[i * 2];
+                float y = points[i * 2 + 1];
+                bounds[0] = x < bounds[0] ? x : bounds[0];
+                bounds[1] = y < bounds[1] ? y : bounds[1];
+                bounds[2] = x > bounds[2] ? x : bounds[2];
+                bounds[3] = y > bounds[3] ? y : bounds[3];
+        }
+}
+
+
+/* ------------------------------------------------------- Render Commands -- */
+
+
+uint32_t
+nbr_cmd_buf_get_mapped_size(struct nbr_cmd_limits lim) {
+        uint32_t result = sizeof(struct nbr_cmd_buf);
+        result += sizeof(struct nbr_cmd) * lim.cmd_count_max;
+        return result;
+}
+
+
+uint32_t
+nbr_cmd_buf_get_size(struct nbr_cmd_limits lim) {
+        uint32_t result = nbr_cmd_buf_get_mapped_size(lim);
+        result += sizeof(struct nbr_vtx) * lim.vtx_count_max;
+        result += sizeof(nbr_idx) * lim.idx_count_max;
+        return result;
+}
+
+
+nb_result
+nbr_cmd_buf_init_mapped(
+        struct nbr_cmd_buf **out_buf,
+        struct nbr_cmd_limits lim,
+        void *mem,
+        struct nbr_vtx *vtx_mem,
+        nbr_idx *idx_mem)
+{
+        nb_result result = NB_OK;
+
+#if NBI_VTX_STREAM
+        /* indices are streamed a word at a time */
+        NB_ASSERT(((uintptr_t)idx_mem & 3) == 0);
+#endif
+
+        if(out_buf && mem && vtx_mem && idx_mem) {
+                uint8_t *ptr = (uint8_t *)mem;
+
+                struct nbr_cmd_buf *buf = (struct nbr_cmd_buf *)ptr;
+                ptr += sizeof(struct nbr_cmd_buf);
+
+                buf->cmds = (struct nbr_cmd *)ptr;
+                buf->cmd_count = 0;
+                buf->cmd_count_max = lim.cmd_count_max;
+                buf->cmd_merged_count = 0;
+                buf->scissor_dropped_count = 0;
+                buf->clip_count = 0;
+                buf->scissor_valid = 0;
+                buf->viewport[0] = 0;
+                buf->viewport[1] = 0;
+
+                buf->next = 0;
+                buf->tail = buf;
+                buf->chunk_limits = lim;
+                buf->growable = 0;
+
+                buf->vtx_buf.vtx = vtx_mem;
+                buf->vtx_buf.vtx_count = 0;
+                buf->vtx_buf.vtx_count_max = lim.vtx_count_max;
+                buf->vtx_buf.vtx_base = 0;
+
+                buf->vtx_buf.idx = idx_mem;
+                buf->vtx_buf.idx_count = 0;
+                buf->vtx_buf.idx_count_max = lim.idx_count_max;
+                buf->vtx_buf.idx_word = 0;
+                buf->vtx_buf.idx_word_end = 0;
+
+                buf->mapped = 1;
+
+                *out_buf = buf;
+        }
+        else {
+                NB_ASSERT(!"nbr_cmd_buf_init_mapped: NB_INVALID_PARAMS");
+                result = NB_INVALID_PARAMS;
+        }
+        return result;
+}
+
+
+nb_result
+nbr_cmd_buf_init(struct nbr_cmd_buf **out_buf, struct nbr_cmd_limits lim, void *mem) {
+        if(!out_buf || !mem) {
+                NB_ASSERT(!"nbr_cmd_buf_init: NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        /* vertices and indices follow the commands in the same block */
+        uint8_t *ptr = (uint8_t *)mem + nbr_cmd_buf_get_mapped_size(lim);
+        struct nbr_vtx *vtx = (struct nbr_vtx *)ptr;
+        nbr_idx *idx = (nbr_idx *)(ptr + sizeof(struct nbr_vtx) * lim.vtx_count_max);
+
+        nb_result result = nbr_cmd_buf_init_mapped(out_buf, lim, mem, vtx, idx);
+        if(result == NB_OK) {
+                (*out_buf)->mapped = 0;
+        }
+
+        return result;
+}
+
+
+void
+nbr_cmd_buf_flush(struct nbr_cmd_buf *buf) {
+        if(!buf) {
+                NB_ASSERT(!"nbr_cmd_buf_flush: NB_INVALID_PARAMS");
+                return;
+        }
+
+#if NBI_VTX_STREAM
+        /* streamed stores are weakly ordered, fence them before anyone reads */
+        _mm_sfence();
+#endif
+}
+
+
+void
+nbr_cmd_buf_array_clear(struct nbr_cmd_buf **bufs, uint32_t buf_count) {
+        if(bufs && buf_count) {
+                uint32_t i;
+                for(i = 0; i < buf_count; i++) {
+                        struct nbr_cmd_buf *buf = bufs[i];
+                        if(buf) {
+                                struct nbr_cmd_buf *chunk;
+                                for(chunk = buf; chunk; chunk = chunk->next) {
+                                        chunk->cmd_count = 0;
+                                        chunk->cmd_merged_count = 0;
+                                        chunk->scissor_dropped_count = 0;
+                                        chunk->vtx_buf.vtx_count = 0;
+                                        chunk->vtx_buf.idx_count = 0;
+                                        chunk->vtx_buf.vtx_base = 0;
+                                        chunk->vtx_buf.idx_word = 0;
+                                        chunk->vtx_buf.idx_word_end = 0;
+                                }
+
+                                buf->clip_count = 0;
+                                buf->scissor_valid = 0;
+                                buf->tail = buf;
+                        }
+                        else {
+                                NB_ASSERT(!"nbr_cmd_buf_array_clear: buf is null!");
+                        }
+                }
+        }
+}
+
+
+void
+nbr_cmd_buf_clear(struct nbr_cmd_buf *buf) {
+        if(buf) {
+                nbr_cmd_buf_array_clear(&buf, 1);
+        }
+}
+
+
+void
+nbr_cmd_buf_get_stats(struct nbr_cmd_buf *buf, struct nbr_cmd_stats *out_stats) {
+        if(buf && out_stats) {
+                NB_ZERO_MEM(out_stats);
+
+                struct nbr_cmd_buf *chunk;
+                for(chunk = buf; chunk; chunk = chunk->next) {
+                        out_stats->cmd_count += chunk->cmd_count;
+                        out_stats->cmd_merged_count += chunk->cmd_merged_count;
+                        out_stats->scissor_dropped_count += chunk->scissor_dropped_count;
+                        out_stats->vtx_count += chunk->vtx_buf.vtx_count;
+                        out_stats->idx_count += chunk->vtx_buf.idx_count;
+                }
+        }
+        else {
+                NB_ASSERT(!"nbr_cmd_buf_get_stats: NB_INVALID_PARAMS");
+        }
+}
+
+
+static struct nbr_cmd_buf *
+nbi_cmd_buf_alloc(struct nbr_cmd_limits lim) {
+        void *mem = NB_ALLOC(nbr_cmd_buf_get_size(lim));
+        if(!mem) {
+                NB_ASSERT(!"nbi_cmd_buf_alloc: NB_FAIL");
+                return 0;
+        }
+
+        struct nbr_cmd_buf *buf = 0;
+        nbr_cmd_buf_init(&buf, lim, mem);
+        return buf;
+}
+
+
+nb_result
+nbr_cmd_buf_create(struct nbr_cmd_buf **out_buf, struct nbr_cmd_limits lim) {
+        if(!out_buf) {
+                NB_ASSERT(!"nbr_cmd_buf_create: NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        struct nbr_cmd_buf *buf = nbi_cmd_buf_alloc(lim);
+        if(!buf) {
+                return NB_FAIL;
+        }
+
+        buf->growable = 1;
+        *out_buf = buf;
+        return NB_OK;
+}
+
+
+void
+nbr_cmd_buf_destroy(struct nbr_cmd_buf **buf) {
+        if(!buf || !*buf) {
+                NB_ASSERT(!"nbr_cmd_buf_destroy: NB_INVALID_PARAMS");
+                return;
+        }
+
+        NB_ASSERT((*buf)->growable && "nbr_cmd_buf_destroy: buf was not created");
+
+        struct nbr_cmd_buf *chunk = *buf;
+        while(chunk) {
+                struct nbr_cmd_buf *next = chunk->next;
+                NB_FREE(chunk);
+                chunk = next;
+        }
+
+        *buf = 0;
+}
+
+
+void
+nbr_cmd_buf_trim(struct nbr_cmd_buf *buf) {
+        if(!buf) {
+                NB_ASSERT(!"nbr_cmd_buf_trim: NB_INVALID_PARAMS");
+                return;
+        }
+
+        struct nbr_cmd_buf *chunk = buf->tail->next;
+        buf->tail->next = 0;
+
+        while(chunk) {
+                struct nbr_cmd_buf *next = chunk->next;
+                NB_FREE(chunk);
+                chunk = next;
+        }
+}
+
+
+static int
+nbi_cmd_buf_fits(
+        const struct nbr_cmd_buf *chunk,
+        uint32_t cmd_count,
+        uint32_t vtx_count,
+        uint32_t idx_count)
+{
+        return (uint64_t)chunk->cmd_count + cmd_count <= chunk->cmd_count_max &&
+                (uint64_t)chunk->vtx_buf.vtx_count + vtx_count <= chunk->vtx_buf.vtx_count_max &&
+                (uint64_t)chunk->vtx_buf.idx_count + idx_count <= chunk->vtx_buf.idx_count_max;
+}
+
+
+/*
+ * Returns the chunk a primitive of `vtx_count` vertices and `idx_count`
+ * indices is recorded into. Fixed buffers always record into themselves,
+ * growable ones move on to the next chunk that fits or link a new one.
+ */
+static struct nbr_cmd_buf *
+nbi_cmd_buf_reserve(
+        struct nbr_cmd_buf *buf,
+        uint32_t vtx_count,
+        uint32_t idx_count)
+{
+        if(!buf->growable) {
+                return buf;
+        }
+
+        /* commands split when the base vertex moves, leave room for them */
+        uint32_t cmd_count = 2 + (uint32_t)(((uint64_t)vtx_count * 2) / ((uint64_t)NBR_VERTEX_COUNT_MAX + 1));
+
+        struct nbr_cmd_buf *chunk = buf->tail;
+        while(!nbi_cmd_buf_fits(chunk, cmd_count, vtx_count, idx_count)) {
+                if(!chunk->next) {
+                        struct nbr_cmd_limits lim = buf->chunk_limits;
+                        lim.cmd_count_max = lim.cmd_count_max > cmd_count ? lim.cmd_count_max : cmd_count;
+                        lim.vtx_count_max = lim.vtx_count_max > vtx_count ? lim.vtx_count_max : vtx_count;
+                        lim.idx_count_max = lim.idx_count_max > idx_count ? lim.idx_count_max : idx_count;
+
+                        chunk->next = nbi_cmd_buf_alloc(lim);
+                        if(!chunk->next) {
+                                break;
+                        }
+                }
+
+                chunk = chunk->next;
+        }
+
+        buf->tail = chunk;
+        return chunk;
+}
+
+
+static struct nbr_cmd *
+nbi_cmd_push(struct nbr_cmd_buf *buf) {
+        struct nbr_cmd *result = 0;
+        if(buf) {
+                if(buf->cmd_count < buf->cmd_count_max) {
+                        result = buf->cmds + buf->cmd_count++;
+                        struct nbr_cmd empty_cmd = { 0 };
+                        *result = empty_cmd;
+                }
+                else {
+                        NB_ASSERT(!"nbi_cmd_push: cmd buf full!");
+                }
+        }
+        else {
+                NB_ASSERT(!"nbi_cmd_push: cmd buf is null!");
+        }
+        return result;
+}
+
+
+/*
+ * Starts an element command with room for `vtx_count` vertices that its
+ * indices can reach. When they would run past what nbr_idx can address the
+ * buffer moves to a new base vertex, which the command records so backends
+ * can draw it with a base vertex offset. A command of the same type on the
+ * same base that ends where this one starts is extended instead, so runs of
+ * primitives become one draw.
+ */
+static struct nbr_cmd *
+nbi_cmd_begin(
+        struct nbr_cmd_buf * buf,
+        struct nbr_vtx_buf * data,
+        uint32_t type,
+        uint32_t vtx_count,
+        nbr_idx * vtx)
+{
+        if((uint64_t)(data->vtx_count - data->vtx_base) + vtx_count > (uint64_t)NBR_VERTEX_COUNT_MAX + 1) {
+                data->vtx_base = data->vtx_count;
+        }
+
+#if NBR_INDEX_SIZE < 32
+        /* 32 bit indices address any uint32_t count */
+        if((uint64_t)vtx_count > (uint64_t)NBR_VERTEX_COUNT_MAX + 1) {
+                NB_ASSERT(!"nbi_cmd_begin: too many vertices for one command!");
+        }
+#endif
+
+        struct nbr_cmd *result = buf && buf->cmd_count ? buf->cmds + buf->cmd_count - 1 : 0;
+        if(result && result->type == type &&
+                result->data.elem.vtx_offset == data->vtx_base &&
+                result->data.elem.offset + result->data.elem.count == data->idx_count)
+        {
+                buf->cmd_merged_count += 1;
+        }
+        else {
+                result = nbi_cmd_push(buf);
+                if(result) {
+                        result->type = type;
+                        result->data.elem.offset = data->idx_count;
+                        result->data.elem.vtx_offset = data->vtx_base;
+                }
+        }
+
+        if(vtx) {
+                *vtx = (nbr_idx)(data->vtx_count - data->vtx_base);
+        }
+        return result;
+}
+
+static void
+nbi_cmd_end(struct nbr_vtx_buf *data, struct nbr_cmd *cmd) {
+        if(cmd) {
+                if(data) {
+                        nbi_idx_flush(data);
+                        cmd->data.elem.count = data->idx_count - cmd->data.elem.offset;
+                }
+                else {
+                        NB_ASSERT(!"nbi_cmd_end: data cannot be null!");
+                }
+        }
+}
+
+
+/*
+ * Ends `cmd` and starts a like one on a new base vertex when `vtx_count`
+ * more vertices would not be addressable from it, for primitives that grow
+ * a command piece by piece.
+ */
+static struct nbr_cmd *
+nbi_cmd_split(
+        struct nbr_cmd_buf *buf,
+        struct nbr_vtx_buf *data,
+        struct nbr_cmd *cmd,
+        uint32_t vtx_count,
+        nbr_idx *vtx)
+{
+        if((uint64_t)(data->vtx_count - data->vtx_base) + vtx_count <= (uint64_t)NBR_VERTEX_COUNT_MAX + 1) {
+                return cmd;
+        }
+
+        uint32_t type = cmd ? cmd->type : NBR_CMD_TYPE_TRIANGLES;
+        nbi_cmd_end(data, cmd);
+        return nbi_cmd_begin(buf, data, type, vtx_count, vtx);
+}
+
+
+static uint32_t
+nbi_corner_segs(struct nb_renderer_ctx *ctx, uint32_t radius) {
+        if(radius < NB_ARR_COUNT(ctx->corner_segs)) {
+                return ctx->corner_segs[radius];
+        }
+        return NBR_CORNER_SEGMENTS_MAX;
+}
+
+
+/* radius clamped to half the shorter side */
+static uint32_t
+nbi_box_radius(struct nb_rect rec, uint32_t radius) {
+        uint32_t extent_min = (rec.w > 0 && rec.h > 0) ? (uint32_t)((rec.w < rec.h ? rec.w : rec.h) / 2) : 0;
+        return radius > extent_min ? extent_min : radius;
+}
+
+
+/* the outline is convex, so it is drawn as a fan from its first vertex */
+static void
+nbi_push_fan_idxs(struct nbr_vtx_buf *data, nbr_idx vtx, uint32_t count) {
+        nbr_idx *idx = data->idx + data->idx_count;
+        uint32_t i;
+        for(i = 1; i < count - 1; i++) {
+                nbi_idx_set(data, idx + 0, vtx);
+                nbi_idx_set(data, idx + 1, vtx + i);
+                nbi_idx_set(data, idx + 2, vtx + i + 1);
+                idx += 3;
+        }
+        data->idx_count += (count - 2) * 3;
+}
+
+
+/*
+ * Writes the 4 * (segs + 1) outline vertices of a rounded rect, the caller
+ * has checked there is room for them.
+ */
+static void
+nbi_push_round_outline(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_vtx_buf *data,
+        const float *rect,
+        float r,
+        uint32_t segs,
+        uint32_t color)
+{
+        uint32_t i;
+        uint32_t corner_count = segs + 1;
+
+        /* corners counter clockwise from the top right, y grows downward */
+        float lft = rect[0] + r;
+        float rgt = rect[0] + rect[2] - r;
+        float top = rect[1] + r;
+        float bot = rect[1] + rect[3] - r;
+
+        const float (*unit)[4] = (const float (*)[4])ctx->corner_unit[segs];
+        struct nbr_vtx *v0 = data->vtx + data->vtx_count;
+        struct nbr_vtx *v1 = v0 + corner_count;
+        struct nbr_vtx *v2 = v1 + corner_count;
+        struct nbr_vtx *v3 = v2 + corner_count;
+
+#if NBI_VTX_SSE2
+        __m128 base0 = _mm_setr_ps(rgt, top, 0.0f, 0.0f);
+        __m128 base1 = _mm_setr_ps(lft, top, 0.0f, 0.0f);
+        __m128 base2 = _mm_setr_ps(lft, bot, 0.0f, 0.0f);
+        __m128 base3 = _mm_setr_ps(rgt, bot, 0.0f, 0.0f);
+        __m128 r0 = _mm_setr_ps(r, -r, 0.0f, 0.0f);
+        __m128 r1 = _mm_setr_ps(-r, -r, 0.0f, 0.0f);
+        __m128 r2 = _mm_setr_ps(-r, r, 0.0f, 0.0f);
+        __m128 r3 = _mm_setr_ps(r, r, 0.0f, 0.0f);
+
+        for(i = 0; i < corner_count; i++) {
+                /* (cos, sin, 0, 0) and (sin, cos, 0, 0), u and v stay zero */
+                __m128 cs = _mm_loadu_ps(unit[i]);
+                __m128 sc = _mm_shuffle_ps(cs, cs, _MM_SHUFFLE(3, 2, 0, 1));
+
+                _mm_storeu_ps(&v0[i].x, _mm_add_ps(base0, _mm_mul_ps(cs, r0)));
+                _mm_storeu_ps(&v1[i].x, _mm_add_ps(base1, _mm_mul_ps(sc, r1)));
+                _mm_storeu_ps(&v2[i].x, _mm_add_ps(base2, _mm_mul_ps(cs, r2)));
+                _mm_storeu_ps(&v3[i].x, _mm_add_ps(base3, _mm_mul_ps(sc, r3)));
+
+                v0[i].c = color;
+                v1[i].c = color;
+                v2[i].c = color;
+                v3[i].c = color;
+        }
+#else
+        for(i = 0; i < corner_count; i++) {
+                float c = unit[i][0] * r;
+                float s = unit[i][1] * r;
+
+                nbi_vtx_set(v0 + i, rgt + c, top - s, 0.0f, 0.0f, color);
+                nbi_vtx_set(v1 + i, lft - s, top - c, 0.0f, 0.0f, color);
+                nbi_vtx_set(v2 + i, lft - c, bot + s, 0.0f, 0.0f, color);
+                nbi_vtx_set(v3 + i, rgt + s, bot + c, 0.0f, 0.0f, color);
+        }
+#endif
+
+        data->vtx_count += corner_count * 4;
+}
+
+
+/* walks the points with the unit directions into and out of each */
+struct nbi_polyline_it {
+        const float *points;
+        uint32_t count;
+        uint32_t closed;
+        uint32_t i;
+        float d_in[2];
+        float d_out[2];
+};
+
+
+/* unit direction from a to b, or `prev` when they are the same point */
+static void
+nbi_polyline_dir(const float *a, const float *b, const float *prev, float *out) {
+        float dx = b[0] - a[0];
+        float dy = b[1] - a[1];
+        float len2 = dx * dx + dy * dy;
+        if(len2 > 1e-12f) {
+                float inv = 1.0f / sqrtf(len2);
+                out[0] = dx * inv;
+                out[1] = dy * inv;
+        }
+        else {
+                out[0] = prev[0];
+                out[1] = prev[1];
+        }
+}
+
+
+static void
+nbi_polyline_begin(struct nbi_polyline_it *it, const float *points, uint32_t count, uint32_t closed) {
+        static const float right[2] = { 1.0f, 0.0f };
+
+        it->points = points;
+        it->count = count;
+        it->closed = closed;
+        it->i = 0;
+
+        nbi_polyline_dir(points, points + 2, right, it->d_out);
+        if(closed) {
+                nbi_polyline_dir(points + (count - 1) * 2, points, it->d_out, it->d_in);
+        }
+        else {
+                it->d_in[0] = it->d_out[0];
+                it->d_in[1] = it->d_out[1];
+        }
+}
+
+
+static void
+nbi_polyline_next(struct nbi_polyline_it *it) {
+        it->i += 1;
+        if(it->i >= it->count) {
+                return;
+        }
+
+        const float *p = it->points + it->i * 2;
+        it->d_in[0] = it->d_out[0];
+        it->d_in[1] = it->d_out[1];
+
+        if(it->i + 1 < it->count) {
+                nbi_polyline_dir(p, p + 2, it->d_in, it->d_out);
+        }
+        else if(it->closed) {
+                nbi_polyline_dir(p, it->points, it->d_in, it->d_out);
+        }
+}
+
+
+/*
+ * Miter direction and half length at the current point, returns 0 when the
+ * joint is sharper than NBR_POLYLINE_MITER_LIMIT allows.
+ */
+static int
+nbi_polyline_miter(const struct nbi_polyline_it *it, float hw, float *m, float *scale) {
+        /* sum of the normals, which point to the left of travel */
+        m[0] = -(it->d_in[1] + it->d_out[1]);
+        m[1] = it->d_in[0] + it->d_out[0];
+
+        float len2 = m[0] * m[0] + m[1] * m[1];
+        if(len2 <= 1e-6f) {
+                return 0;
+        }
+
+        float inv = 1.0f / sqrtf(len2);
+        m[0] *= inv;
+        m[1] *= inv;
+
+        float cos_half = -m[0] * it->d_out[1] + m[1] * it->d_out[0];
+        if(cos_half * NBR_POLYLINE_MITER_LIMIT <= 1.0f) {
+                return 0;
+        }
+
+        *scale = hw / cos_half;
+        return 1;
+}
+
+
+static void
+nbi_polyline_vtx(struct nbr_vtx *v, float x, float y, uint32_t color) {
+        nbi_vtx_set(v, x, y, 0.0f, 0.0f, color);
+}
+
+
+/* ------------------------------------------------------------ Feathering -- */
+
+
+static uint32_t
+nbi_color_clear(uint32_t color) {
+        return color & 0xFFFFFF00u;
+}
+
+
+/* ring of quads between two outlines with the same vertex count */
+static void
+nbi_push_ring_idxs(struct nbr_vtx_buf *data, nbr_idx ring_in, nbr_idx ring_out, uint32_t count) {
+        uint32_t i;
+        for(i = 0; i < count; i++) {
+                nbr_idx j = i + 1 < count ? i + 1 : 0;
+                nbi_push_quad_idxs(data, ring_out + i, ring_in + i, ring_in + j, ring_out + j);
+        }
+}
+
+
+/*
+ * Joins an inner outline of `in_segs` segments per corner to an outer one of
+ * `out_segs`. Each corner's arcs are merged by angle, so a sharp inner
+ * corner becomes a wedge fanned out from its one vertex.
+ */
+static void
+nbi_push_ring_stitch_idxs(
+        struct nbr_vtx_buf *data,
+        nbr_idx ring_in,
+        uint32_t in_segs,
+        nbr_idx ring_out,
+        uint32_t out_segs)
+{
+        uint32_t c;
+        for(c = 0; c < 4; c++) {
+                nbr_idx in = ring_in + c * (in_segs + 1);
+                nbr_idx out = ring_out + c * (out_segs + 1);
+                uint32_t i = 0, o = 0;
+
+                /* step along whichever arc has the nearer next angle */
+                while(i < in_segs || o < out_segs) {
+                        if(o == out_segs || (i < in_segs && (i + 1) * out_segs <= (o + 1) * in_segs)) {
+                                nbi_push_idx(data, out + o);
+                                nbi_push_idx(data, in + i);
+                                nbi_push_idx(data, in + i + 1);
+                                i++;
+                        }
+                        else {
+                                nbi_push_idx(data, out + o);
+                                nbi_push_idx(data, in + i);
+                                nbi_push_idx(data, out + o + 1);
+                                o++;
+                        }
+                }
+
+                /* straight side to the next corner */
+                uint32_t n = (c + 1) % 4;
+                nbi_push_quad_idxs(data, out + out_segs, in + in_segs, ring_in + n * (in_segs + 1), ring_out + n * (out_segs + 1));
+        }
+}
+
+
+/* outline vertex count of a box, sharp boxes keep just their four corners */
+static uint32_t
+nbi_box_outline_count(struct nb_renderer_ctx *ctx, uint32_t radius) {
+        return radius ? (nbi_corner_segs(ctx, radius) + 1) * 4 : 4;
+}
+
+
+/*
+ * A feathered box is filled up to half the fringe inside its edge, and a
+ * ring fades out to half the fringe outside it. The caller has checked
+ * there is room for 2 outlines, a fan and a ring.
+ */
+static void
+nbi_push_box_feathered(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_vtx_buf *data,
+        nbr_idx vtx,
+        const float *rect,
+        uint32_t radius,
+        uint32_t color)
+{
+        float half = NBR_AA_FRINGE * 0.5f;
+        uint32_t segs = radius ? nbi_corner_segs(ctx, radius) : 0;
+        uint32_t count = (segs + 1) * 4;
+
+        float inner[4] = { rect[0] + half, rect[1] + half, rect[2] - half * 2.0f, rect[3] - half * 2.0f };
+        float outer[4] = { rect[0] - half, rect[1] - half, rect[2] + half * 2.0f, rect[3] + half * 2.0f };
+        float inner_radius = radius ? (float)radius - half : 0.0f;
+        float outer_radius = radius ? (float)radius + half : 0.0f;
+
+        if(inner_radius < 0.0f) {
+                inner_radius = 0.0f;
+        }
+
+        nbi_push_fan_idxs(data, vtx, count);
+        nbi_push_ring_idxs(data, vtx, vtx + count, count);
+
+        nbi_push_round_outline(ctx, data, inner, inner_radius, segs, color);
+        nbi_push_round_outline(ctx, data, outer, outer_radius, segs, nbi_color_clear(color));
+}
+
+
+/*
+ * Strokes get a full color core `width - NBR_AA_FRINGE` wide with a fringe
+ * fading out on both sides, so a 1px line covers 1px with soft edges.
+ * Points are laid out as lanes across the stroke, outermost first.
+ */
+static uint32_t
+nbi_stroke_lanes(float width) {
+        return width > NBR_AA_FRINGE ? 4 : 3;
+}
+
+
+static void
+nbi_stroke_counts(uint32_t count, uint32_t closed, float width, uint32_t *vtx_count, uint32_t *idx_count) {
+        uint32_t lanes = nbi_stroke_lanes(width);
+        uint32_t seg_count = closed ? count : count - 1;
+
+        *vtx_count = count * lanes;
+        *idx_count = seg_count * (lanes - 1) * 6;
+}
+
+
+static void
+nbi_push_stroke_feathered(
+        struct nbr_vtx_buf *data,
+        nbr_idx vtx,
+        const float *points,
+        uint32_t count,
+        uint32_t closed,
+        float width,
+        uint32_t color)
+{
+        uint32_t lanes = nbi_stroke_lanes(width);
+        uint32_t clear = nbi_color_clear(color);
+        float core = lanes == 4 ? (width - NBR_AA_FRINGE) * 0.5f : 0.0f;
+        float edge = core + NBR_AA_FRINGE;
+
+        struct nbr_vtx *v = data->vtx + data->vtx_count;
+        nbr_idx *idx = data->idx + data->idx_count;
+        uint32_t seg_count = closed ? count : count - 1;
+        uint32_t i, k;
+
+        struct nbi_polyline_it it;
+        for(nbi_polyline_begin(&it, points, count, closed); it.i < count; nbi_polyline_next(&it)) {
+                const float *p = points + it.i * 2;
+                float m[2], scale;
+
+                /* sharp joints keep the outgoing normal rather than a long miter */
+                if(!nbi_polyline_miter(&it, 1.0f, m, &scale)) {
+                        m[0] = -it.d_out[1];
+                        m[1] = it.d_out[0];
+                        scale = 1.0f;
+                }
+
+                float ex = m[0] * edge * scale, ey = m[1] * edge * scale;
+                float cx = m[0] * core * scale, cy = m[1] * core * scale;
+
+                nbi_polyline_vtx(v++, p[0] + ex, p[1] + ey, clear);
+                if(lanes == 4) {
+                        nbi_polyline_vtx(v++, p[0] + cx, p[1] + cy, color);
+                        nbi_polyline_vtx(v++, p[0] - cx, p[1] - cy, color);
+                }
+                else {
+                        nbi_polyline_vtx(v++, p[0], p[1], color);
+                }
+                nbi_polyline_vtx(v++, p[0] - ex, p[1] - ey, clear);
+        }
+
+        for(i = 0; i < seg_count; i++) {
+                nbr_idx a = vtx + i * lanes;
+                nbr_idx b = vtx + (i + 1 < count ? i + 1 : 0) * lanes;
+
+                for(k = 0; k + 1 < lanes; k++) {
+                        nbi_idx_set(data, idx + 0, a + k);
+                        nbi_idx_set(data, idx + 1, a + k + 1);
+                        nbi_idx_set(data, idx + 2, b + k + 1);
+                        nbi_idx_set(data, idx + 3, a + k);
+                        nbi_idx_set(data, idx + 4, b + k + 1);
+                        nbi_idx_set(data, idx + 5, b + k);
+                        idx += 6;
+                }
+        }
+
+        data->vtx_count += count * lanes;
+        data->idx_count += seg_count * (lanes - 1) * 6;
+}
+
+
+/* a feathered stroke as its own command, for the line primitives */
+static void
+nbi_stroke_feathered(
+        struct nbr_cmd_buf *buf,
+        const float *points,
+        uint32_t count,
+        uint32_t closed,
+        float width,
+        uint32_t color)
+{
+        uint32_t vtx_count, idx_count;
+        nbi_stroke_counts(count, closed, width, &vtx_count, &idx_count);
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbi_stroke_feathered: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, vtx_count, &vtx);
+
+        nbi_push_stroke_feathered(data, vtx, points, count, closed, width, color);
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+nb_result
+nbr_cmd_reserve(
+        struct nbr_cmd_buf *buf,
+        uint32_t type,
+        uint32_t vtx_count,
+        uint32_t idx_count,
+        struct nbr_cmd_reservation *out)
+{
+        if(!buf || !out || (type != NBR_CMD_TYPE_TRIANGLES && type != NBR_CMD_TYPE_LINES)) {
+                NB_ASSERT(!"nbr_cmd_reserve: NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+#if NBR_INDEX_SIZE < 32
+        if((uint64_t)vtx_count > (uint64_t)NBR_VERTEX_COUNT_MAX + 1) {
+                NB_ASSERT(!"nbr_cmd_reserve: more vertices than nbr_idx addresses!");
+                return NB_INVALID_PARAMS;
+        }
+#endif
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbr_cmd_reserve: vtx buf full!");
+                return NB_FAIL;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, type, vtx_count, &vtx);
+        if(!cmd) {
+                return NB_FAIL;
+        }
+
+#if NBI_VTX_STREAM
+        /* the caller stores next to streamed indices, those have to land first */
+        _mm_sfence();
+#endif
+
+        out->vtx = data->vtx + data->vtx_count;
+        out->idx = data->idx + data->idx_count;
+        out->base = vtx;
+
+        data->vtx_count += vtx_count;
+        data->idx_count += idx_count;
+        nbi_cmd_end(data, cmd);
+
+        return NB_OK;
+}
+
+
+void
+nbr_vtx_set(
+        struct nbr_vtx *vtx,
+        float x,
+        float y,
+        float u,
+        float v,
+        uint32_t color)
+{
+        nbi_vtx_set(vtx, x, y, u, v, color);
+}
+
+
+void
+nbr_box(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rec,
+        uint32_t color,
+        uint32_t radius)
+{
+        NB_ASSERT(ctx);
+
+        radius = nbi_box_radius(rec, radius);
+
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, !radius && !ctx->anti_alias, &cull);
+        if(nbi_culled_rect(&cull, rec, ctx->anti_alias ? NBR_AA_FRINGE : 0.0f)) {
+                return;
+        }
+
+        const struct nb_rect *clip = nbi_clip_top(buf);
+        if(clip && !radius && !ctx->anti_alias && !nbi_clip_rect(clip, &rec)) {
+                return;
+        }
+
+        float rect[4];
+        rect[0] = (float)rec.x; rect[1] = (float)rec.y;
+        rect[2] = (float)rec.w; rect[3] = (float)rec.h;
+
+        uint32_t count = nbi_box_outline_count(ctx, radius);
+        uint32_t box_vtx_count = ctx->anti_alias ? count * 2 : count;
+        uint32_t box_idx_count = (count - 2) * 3 + (ctx->anti_alias ? count * 6 : 0);
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, box_vtx_count, box_idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        /* the sharp and rounded fills fit in the same outline count */
+        if(data->vtx_count + box_vtx_count > data->vtx_count_max || data->idx_count + box_idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbr_box: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, box_vtx_count, &vtx);
+
+        if(ctx->anti_alias) {
+                nbi_push_box_feathered(ctx, data, vtx, rect, radius, color);
+                nbi_cmd_end(data, cmd);
+                return;
+        }
+
+        /* sharp corners - shortcut */
+        if(!radius) {
+                nbi_push_quad(data, vtx, rect, color);
+                nbi_cmd_end(data, cmd);
+                return;
+        }
+
+        uint32_t segs = nbi_corner_segs(ctx, radius);
+        uint32_t vtx_count = (segs + 1) * 4;
+
+        nbi_push_fan_idxs(data, vtx, vtx_count);
+        nbi_push_round_outline(ctx, data, rect, (float)radius, segs, color);
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_box_bordered(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rec,
+        uint32_t color,
+        uint32_t radius,
+        uint32_t border_color,
+        uint32_t border)
+{
+        NB_ASSERT(ctx);
+
+        if(!border) {
+                nbr_box(ctx, buf, rec, color, radius);
+                return;
+        }
+
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        if(nbi_culled_rect(&cull, rec, (float)border + (ctx->anti_alias ? NBR_AA_FRINGE : 0.0f))) {
+                return;
+        }
+
+        float inner[4];
+        inner[0] = (float)rec.x; inner[1] = (float)rec.y;
+        inner[2] = (float)rec.w; inner[3] = (float)rec.h;
+
+        float outer[4];
+        outer[0] = inner[0] - (float)border; outer[1] = inner[1] - (float)border;
+        outer[2] = inner[2] + (float)(border * 2); outer[3] = inner[3] + (float)(border * 2);
+
+        radius = nbi_box_radius(rec, radius);
+
+        /* a border in the fill color is just a bigger box */
+        if(color == border_color) {
+                struct nb_rect outer_rec = { rec.x - (int)border, rec.y - (int)border, rec.w + (int)(border * 2), rec.h + (int)(border * 2) };
+                nbr_box(ctx, buf, outer_rec, color, radius + border);
+                return;
+        }
+
+        /* each outline has its own segment count, a sharp fill is a quad */
+        uint32_t in_segs = nbi_corner_segs(ctx, radius);
+        uint32_t out_segs = nbi_corner_segs(ctx, radius + border);
+        uint32_t in_count = (in_segs + 1) * 4;
+        uint32_t out_count = (out_segs + 1) * 4;
+        uint32_t vtx_count = in_count * 2 + out_count * (ctx->anti_alias ? 2 : 1);
+        uint32_t idx_count = (in_count - 2) * 3 + ((in_segs + out_segs) * 3 + 6) * 4 + (ctx->anti_alias ? out_count * 6 : 0);
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbr_box_bordered: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, vtx_count, &vtx);
+
+        nbi_push_fan_idxs(data, vtx, in_count);
+
+        /* ring between the inner and outer outline in the border color */
+        nbr_idx ring_in = vtx + in_count;
+        nbr_idx ring_out = ring_in + in_count;
+        nbi_push_ring_stitch_idxs(data, ring_in, in_segs, ring_out, out_segs);
+
+        /* inner edge twice, once per color, or the ring would blend into the fill */
+        nbi_push_round_outline(ctx, data, inner, (float)radius, in_segs, color);
+        nbi_push_round_outline(ctx, data, inner, (float)radius, in_segs, border_color);
+
+        if(!ctx->anti_alias) {
+                nbi_push_round_outline(ctx, data, outer, (float)(radius + border), out_segs, border_color);
+                nbi_cmd_end(data, cmd);
+                return;
+        }
+
+        /* the border stops half a fringe early and fades out past its edge */
+        float half = NBR_AA_FRINGE * 0.5f;
+        float outer_in[4] = { outer[0] + half, outer[1] + half, outer[2] - half * 2.0f, outer[3] - half * 2.0f };
+        float outer_out[4] = { outer[0] - half, outer[1] - half, outer[2] + half * 2.0f, outer[3] + half * 2.0f };
+
+        nbi_push_ring_idxs(data, ring_out, ring_out + out_count, out_count);
+
+        nbi_push_round_outline(ctx, data, outer_in, (float)(radius + border) - half, out_segs, border_color);
+        nbi_push_round_outline(ctx, data, outer_out, (float)(radius + border) + half, out_segs, nbi_color_clear(border_color));
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_box_batch(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        const struct nb_rect *rects,
+        const uint32_t *colors,
+        const uint32_t *radii,
+        uint32_t count)
+{
+        NB_ASSERT(ctx);
+        NB_ASSERT(rects);
+        NB_ASSERT(colors);
+
+        if(!count) {
+                return;
+        }
+
+        const struct nb_rect *clip = nbi_clip_top(buf);
+
+        /* the clip stack only culls the boxes it clips */
+        struct nbi_cull cull, cull_clipped;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        nbi_cull_init(ctx, buf, 1, &cull_clipped);
+        float pad = ctx->anti_alias ? NBR_AA_FRINGE : 0.0f;
+
+        /* sizes first, so the buffer is only checked once */
+        uint32_t i;
+        uint32_t vtx_count = count * 4;
+        uint32_t idx_count = count * 6;
+        if(radii || ctx->anti_alias) {
+                vtx_count = 0;
+                idx_count = 0;
+                for(i = 0; i < count; i++) {
+                        uint32_t radius = radii ? nbi_box_radius(rects[i], radii[i]) : 0;
+                        uint32_t outline_count = nbi_box_outline_count(ctx, radius);
+                        vtx_count += outline_count;
+                        idx_count += (outline_count - 2) * 3;
+
+                        /* feathered boxes add an outline and a ring */
+                        if(ctx->anti_alias) {
+                                vtx_count += outline_count;
+                                idx_count += outline_count * 6;
+                        }
+                }
+        }
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbr_box_batch: vtx buf full!");
+                return;
+        }
+
+        /* boxes never straddle a base vertex, the command splits between them */
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, 0, &vtx);
+
+#if NBI_VTX_SSE2
+        __m128 zero = _mm_setzero_ps();
+        __m128 mask_x = _mm_castsi128_ps(_mm_setr_epi32(-1, 0, 0, 0));
+        __m128 mask_y = _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, 0));
+#endif
+
+        for(i = 0; i < count; i++) {
+                uint32_t radius = radii ? nbi_box_radius(rects[i], radii[i]) : 0;
+                if(nbi_culled_rect(!radius && !ctx->anti_alias ? &cull_clipped : &cull, rects[i], pad)) {
+                        continue;
+                }
+
+                uint32_t box_vtx_count = nbi_box_outline_count(ctx, radius) * (ctx->anti_alias ? 2 : 1);
+
+                cmd = nbi_cmd_split(chunk, data, cmd, box_vtx_count, &vtx);
+
+                if(ctx->anti_alias) {
+                        float rect[4];
+                        rect[0] = (float)rects[i].x; rect[1] = (float)rects[i].y;
+                        rect[2] = (float)rects[i].w; rect[3] = (float)rects[i].h;
+
+                        nbi_push_box_feathered(ctx, data, vtx, rect, radius, colors[i]);
+                        vtx += box_vtx_count;
+                        continue;
+                }
+
+                if(radius) {
+                        float rect[4];
+                        rect[0] = (float)rects[i].x; rect[1] = (float)rects[i].y;
+                        rect[2] = (float)rects[i].w; rect[3] = (float)rects[i].h;
+
+                        uint32_t segs = nbi_corner_segs(ctx, radius);
+                        uint32_t outline_count = (segs + 1) * 4;
+
+                        nbi_push_fan_idxs(data, vtx, outline_count);
+                        nbi_push_round_outline(ctx, data, rect, (float)radius, segs, colors[i]);
+                        vtx += outline_count;
+                        continue;
+                }
+
+                struct nb_rect rc = rects[i];
+                if(clip && !nbi_clip_rect(clip, &rc)) {
+                        continue;
+                }
+
+                nbi_push_quad_idxs(data, vtx, vtx + 1, vtx + 2, vtx + 3);
+
+                struct nbr_vtx *v = data->vtx + data->vtx_count;
+                uint32_t c = colors[i];
+
+#if NBI_VTX_SSE2
+                /* (x, y, w, h) into the four corners, u and v stay zero */
+                __m128 r = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)&rc));
+                __m128 xy = _mm_movelh_ps(r, zero);
+                __m128 wh = _mm_movehl_ps(zero, r);
+
+                _mm_storeu_ps(&v[0].x, xy);
+                _mm_storeu_ps(&v[1].x, _mm_add_ps(xy, _mm_and_ps(wh, mask_y)));
+                _mm_storeu_ps(&v[2].x, _mm_add_ps(xy, wh));
+                _mm_storeu_ps(&v[3].x, _mm_add_ps(xy, _mm_and_ps(wh, mask_x)));
+
+                v[0].c = c; v[1].c = c; v[2].c = c; v[3].c = c;
+#else
+                float x = (float)rc.x;
+                float y = (float)rc.y;
+                float x1 = x + (float)rc.w;
+                float y1 = y + (float)rc.h;
+
+                nbi_vtx_set(v + 0, x, y, 0.0f, 0.0f, c);
+                nbi_vtx_set(v + 1, x, y1, 0.0f, 0.0f, c);
+                nbi_vtx_set(v + 2, x1, y1, 0.0f, 0.0f, c);
+                nbi_vtx_set(v + 3, x1, y, 0.0f, 0.0f, c);
+#endif
+
+                data->vtx_count += 4;
+                vtx += 4;
+        }
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_line(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        float *p,
+        float *q,
+        uint32_t color)
+{
+        NB_ASSERT(ctx);
+
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        if(nbi_culled_segment(&cull, p, q, 1.0f + NBR_AA_FRINGE)) {
+                return;
+        }
+
+        if(ctx->anti_alias) {
+                float points[4] = { p[0], p[1], q[0], q[1] };
+                nbi_stroke_feathered(buf, points, 2, 0, 1.0f, color);
+                return;
+        }
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, 2, 2);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_LINES, 2, &vtx);
+
+        nbi_push_idx(data, vtx);
+        nbi_push_idx(data, vtx + 1);
+
+        nbi_push_vtx(data, p[0], p[1], color);
+        nbi_push_vtx(data, q[0], q[1], color);
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_line_batch(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        const float *points,
+        const uint32_t *colors,
+        uint32_t count)
+{
+        NB_ASSERT(ctx);
+        NB_ASSERT(points);
+        NB_ASSERT(colors);
+
+        if(!count) {
+                return;
+        }
+
+        uint32_t i;
+
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        float pad = 1.0f + NBR_AA_FRINGE;
+
+        if(ctx->anti_alias) {
+                uint32_t vtx_count, idx_count;
+                nbi_stroke_counts(2, 0, 1.0f, &vtx_count, &idx_count);
+
+                struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count * count, idx_count * count);
+                struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+                if(data->vtx_count + vtx_count * count > data->vtx_count_max || data->idx_count + idx_count * count > data->idx_count_max) {
+                        NB_ASSERT(!"nbr_line_batch: vtx buf full!");
+                        return;
+                }
+
+                nbr_idx vtx;
+                struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, vtx_count, &vtx);
+
+                for(i = 0; i < count; i++) {
+                        if(nbi_culled_segment(&cull, points + i * 4, points + i * 4 + 2, pad)) {
+                                continue;
+                        }
+
+                        cmd = nbi_cmd_split(chunk, data, cmd, vtx_count, &vtx);
+                        nbi_push_stroke_feathered(data, vtx, points + i * 4, 2, 0, 1.0f, colors[i]);
+                        vtx += vtx_count;
+                }
+
+                nbi_cmd_end(data, cmd);
+                return;
+        }
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, count * 2, count * 2);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + count * 2 > data->vtx_count_max || data->idx_count + count * 2 > data->idx_count_max) {
+                NB_ASSERT(!"nbr_line_batch: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_LINES, 2, &vtx);
+
+#if NBI_VTX_SSE2
+        __m128 zero = _mm_setzero_ps();
+#endif
+
+        /* runs of lines that fit below the next base vertex */
+        while(count) {
+                cmd = nbi_cmd_split(chunk, data, cmd, 2, &vtx);
+
+                uint64_t room = ((uint64_t)NBR_VERTEX_COUNT_MAX + 1 - (data->vtx_count - data->vtx_base)) / 2;
+                uint32_t run = room < count ? (uint32_t)room : count;
+
+                nbr_idx *idx = data->idx + data->idx_count;
+                struct nbr_vtx *v = data->vtx + data->vtx_count;
+                uint32_t line_count = 0;
+
+                for(i = 0; i < run; i++, points += 4) {
+                        if(nbi_culled_segment(&cull, points, points + 2, pad)) {
+                                continue;
+                        }
+
+                        nbi_idx_set(data, idx + 0, vtx);
+                        nbi_idx_set(data, idx + 1, vtx + 1);
+
+#if NBI_VTX_SSE2
+                        /* (x0, y0, x1, y1) into two vertices, u and v stay zero */
+                        __m128 p = _mm_loadu_ps(points);
+                        _mm_storeu_ps(&v[0].x, _mm_movelh_ps(p, zero));
+                        _mm_storeu_ps(&v[1].x, _mm_movehl_ps(zero, p));
+
+                        v[0].c = colors[i];
+                        v[1].c = colors[i];
+#else
+                        nbi_vtx_set(v + 0, points[0], points[1], 0.0f, 0.0f, colors[i]);
+                        nbi_vtx_set(v + 1, points[2], points[3], 0.0f, 0.0f, colors[i]);
+#endif
+
+                        idx += 2;
+                        v += 2;
+                        vtx += 2;
+                        line_count++;
+                }
+
+                data->idx_count += line_count * 2;
+                data->vtx_count += line_count * 2;
+                colors += run;
+                count -= run;
+        }
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_polyline(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        const float *points,
+        uint32_t count,
+        uint32_t color,
+        float width,
+        uint32_t flags)
+{
+        NB_ASSERT(ctx);
+        NB_ASSERT(points);
+
+        if(count < 2) {
+                return;
+        }
+
+        /* miters reach at most the limit times half the width past a point */
+        float bounds[4];
+        float pad = (width > 1.0f ? width * 0.5f * NBR_POLYLINE_MITER_LIMIT : 1.0f) + NBR_AA_FRINGE;
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        nbi_points_bounds(points, count, bounds);
+        if(nbi_culled(&cull, bounds[0], bounds[1], bounds[2], bounds[3], pad)) {
+                return;
+        }
+
+        uint32_t closed = flags & NBR_POLYLINE_CLOSED;
+        uint32_t bevel = flags & NBR_POLYLINE_BEVEL;
+        uint32_t hairline = width <= 1.0f && !(flags & NBR_POLYLINE_TRIANGLES);
+        uint32_t seg_count = closed ? count : count - 1;
+
+        uint32_t vtx_count = count;
+        uint32_t idx_count = seg_count * 2;
+
+        if(hairline && ctx->anti_alias) {
+                nbi_stroke_feathered(buf, points, count, closed, width, color);
+                return;
+        }
+
+        if(hairline) {
+                struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+                struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+                if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                        NB_ASSERT(!"nbr_polyline: vtx buf full!");
+                        return;
+                }
+
+                nbr_idx vtx;
+                struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_LINES, vtx_count, &vtx);
+
+                struct nbr_vtx *v = data->vtx + data->vtx_count;
+                nbr_idx *idx = data->idx + data->idx_count;
+                uint32_t i;
+
+                for(i = 0; i < count; i++) {
+                        nbi_polyline_vtx(v + i, points[i * 2], points[i * 2 + 1], color);
+                }
+                for(i = 0; i < seg_count; i++) {
+                        nbi_idx_set(data, idx + i * 2, vtx + i);
+                        nbi_idx_set(data, idx + i * 2 + 1, vtx + (i + 1 < count ? i + 1 : 0));
+                }
+
+                data->vtx_count += vtx_count;
+                data->idx_count += idx_count;
+                nbi_cmd_end(data, cmd);
+                return;
+        }
+
+        float hw = width * 0.5f;
+
+        struct nbi_polyline_it it;
+        uint32_t join_count = 0;
+        if(bevel) {
+                join_count = closed ? count : count - 2;
+        }
+        else {
+                /* miters past the limit fall back to bevels, count them first */
+                for(nbi_polyline_begin(&it, points, count, closed); it.i < count; nbi_polyline_next(&it)) {
+                        float m[2], scale;
+                        join_count += !nbi_polyline_miter(&it, hw, m, &scale);
+                }
+        }
+
+        vtx_count = count * 2 + (bevel ? count * 2 : join_count * 2);
+        idx_count = seg_count * 6 + join_count * 3;
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, vtx_count, idx_count);
+        struct nbr_vtx_buf *data = &chunk->vtx_buf;
+
+        if(data->vtx_count + vtx_count > data->vtx_count_max || data->idx_count + idx_count > data->idx_count_max) {
+                NB_ASSERT(!"nbr_polyline: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd *cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_TRIANGLES, vtx_count, &vtx);
+
+        struct nbr_vtx *v = data->vtx + data->vtx_count;
+        nbr_idx *idx = data->idx + data->idx_count;
+
+        /*
+         * Every point has an incoming pair, left then right of travel, and
+         * bevelled points an outgoing pair after it. Segments run from the
+         * outgoing pair of a point to the incoming pair of the next.
+         */
+        nbr_idx first = vtx;
+        nbr_idx prev_out = vtx;
+        for(nbi_polyline_begin(&it, points, count, closed); it.i < count; nbi_polyline_next(&it)) {
+                const float *p = points + it.i * 2;
+                float m[2], scale;
+                nbr_idx in = vtx;
+
+                if(!bevel && nbi_polyline_miter(&it, hw, m, &scale)) {
+                        nbi_polyline_vtx(v++, p[0] + m[0] * scale, p[1] + m[1] * scale, color);
+                        nbi_polyline_vtx(v++, p[0] - m[0] * scale, p[1] - m[1] * scale, color);
+                        vtx += 2;
+                }
+                else {
+                        float n_in[2] = { -it.d_in[1] * hw, it.d_in[0] * hw };
+                        float n_out[2] = { -it.d_out[1] * hw, it.d_out[0] * hw };
+
+                        nbi_polyline_vtx(v++, p[0] + n_in[0], p[1] + n_in[1], color);
+                        nbi_polyline_vtx(v++, p[0] - n_in[0], p[1] - n_in[1], color);
+                        nbi_polyline_vtx(v++, p[0] + n_out[0], p[1] + n_out[1], color);
+                        nbi_polyline_vtx(v++, p[0] - n_out[0], p[1] - n_out[1], color);
+                        vtx += 4;
+
+                        /*
+                         * fill the gap around the joint, open ends have none.
+                         * The segments overlap on the inner side, so only the
+                         * outer one needs a triangle, right of travel when
+                         * the line turns left.
+                         */
+                        if(closed || (it.i > 0 && it.i + 1 < count)) {
+                                float turn = it.d_in[0] * it.d_out[1] - it.d_in[1] * it.d_out[0];
+                                nbi_idx_set(data, idx + 0, in);
+                                nbi_idx_set(data, idx + 1, turn > 0.0f ? in + 1 : in + 2);
+                                nbi_idx_set(data, idx + 2, turn > 0.0f ? in + 3 : in + 1);
+                                idx += 3;
+                        }
+                }
+
+                if(it.i > 0) {
+                        nbi_idx_set(data, idx + 0, prev_out);
+                        nbi_idx_set(data, idx + 1, prev_out + 1);
+                        nbi_idx_set(data, idx + 2, in + 1);
+                        nbi_idx_set(data, idx + 3, prev_out);
+                        nbi_idx_set(data, idx + 4, in + 1);
+                        nbi_idx_set(data, idx + 5, in);
+                        idx += 6;
+                }
+
+                prev_out = vtx - 2;
+        }
+
+        if(closed) {
+                nbi_idx_set(data, idx + 0, prev_out);
+                nbi_idx_set(data, idx + 1, prev_out + 1);
+                nbi_idx_set(data, idx + 2, first + 1);
+                nbi_idx_set(data, idx + 3, prev_out);
+                nbi_idx_set(data, idx + 4, first + 1);
+                nbi_idx_set(data, idx + 5, first);
+        }
+
+        data->vtx_count += vtx_count;
+        data->idx_count += idx_count;
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+void
+nbr_bez(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        float *p0,
+        float *p1,
+        float *p2,
+        float *p3,
+        uint32_t color)
+{
+        NB_ASSERT(ctx);
+
+        /* the curve stays inside the hull of its control points */
+        float hull[8] = { p0[0], p0[1], p1[0], p1[1], p2[0], p2[1], p3[0], p3[1] };
+        float bounds[4];
+        struct nbi_cull cull;
+        nbi_cull_init(ctx, buf, 0, &cull);
+        nbi_points_bounds(hull, 4, bounds);
+        if(nbi_culled(&cull, bounds[0], bounds[1], bounds[2], bounds[3], 1.0f + NBR_AA_FRINGE)) {
+                return;
+        }
+
+        /*
+         * Wang's formula gives the segment count that keeps every chord
+         * within NBR_BEZ_TOLERANCE pixels of the curve.
+         */
+        float ddx0 = p0[0] - 2.0f * p1[0] + p2[0];
+        float ddy0 = p0[1] - 2.0f * p1[1] + p2[1];
+        float ddx1 = p1[0] - 2.0f * p2[0] + p3[0];
+        float ddy1 = p1[1] - 2.0f * p2[1] + p3[1];
+        float dd0 = ddx0 * ddx0 + ddy0 * ddy0;
+        float dd1 = ddx1 * ddx1 + ddy1 * ddy1;
+        float dd = sqrtf(dd0 > dd1 ? dd0 : dd1);
+
+        float segs = ceilf(sqrtf(0.75f * dd / NBR_BEZ_TOLERANCE));
+        uint32_t seg_count = NBR_BEZ_SEGMENTS_MAX;
+        if(segs < (float)NBR_BEZ_SEGMENTS_MAX) {
+                seg_count = segs > (float)NBR_BEZ_SEGMENTS_MIN ? (uint32_t)segs : NBR_BEZ_SEGMENTS_MIN;
+        }
+
+        /* forward differences of the power basis, one add per step and axis */
+        float points[(NBR_BEZ_SEGMENTS_MAX + 1) * 2];
+        float h = 1.0f / (float)seg_count;
+        float h2 = h * h;
+        float h3 = h2 * h;
+        uint32_t i;
+
+        float pt[2], d1[2], d2[2], d3[2];
+        for(i = 0; i < 2; i++) {
+                float a = -p0[i] + 3.0f * p1[i] - 3.0f * p2[i] + p3[i];
+                float b = 3.0f * p0[i] - 6.0f * p1[i] + 3.0f * p2[i];
+                float c = -3.0f * p0[i] + 3.0f * p1[i];
+
+                pt[i] = p0[i];
+                d1[i] = a * h3 + b * h2 + c * h;
+                d2[i] = 6.0f * a * h3 + 2.0f * b * h2;
+                d3[i] = 6.0f * a * h3;
+        }
+
+        for(i = 0; i < seg_count; i++) {
+                points[i * 2] = pt[0];
+                points[i * 2 + 1] = pt[1];
+
+                pt[0] += d1[0]; d1[0] += d2[0]; d2[0] += d3[0];
+                pt[1] += d1[1]; d1[1] += d2[1]; d2[1] += d3[1];
+        }
+
+        /* end exactly on the last control point */
+        points[seg_count * 2] = p3[0];
+        points[seg_count * 2 + 1] = p3[1];
+
+        if(ctx->anti_alias) {
+                nbi_stroke_feathered(buf, points, seg_count + 1, 0, 1.0f, color);
+                return;
+        }
+
+        struct nbr_cmd_buf * chunk = nbi_cmd_buf_reserve(buf, seg_count + 1, seg_count * 2);
+        struct nbr_vtx_buf * data = &chunk->vtx_buf;
+
+        if(data->vtx_count + seg_count + 1 > data->vtx_count_max || data->idx_count + seg_count * 2 > data->idx_count_max) {
+                NB_ASSERT(!"nbr_bez: vtx buf full!");
+                return;
+        }
+
+        nbr_idx vtx;
+        struct nbr_cmd * cmd = nbi_cmd_begin(chunk, data, NBR_CMD_TYPE_LINES, seg_count + 1, &vtx);
+
+        nbr_idx *idx = data->idx + data->idx_count;
+        struct nbr_vtx *v = data->vtx + data->vtx_count;
+
+        for(i = 0; i < seg_count; i++) {
+                nbi_idx_set(data, idx + i * 2, vtx + i);
+                nbi_idx_set(data, idx + i * 2 + 1, vtx + i + 1);
+        }
+
+        for(i = 0; i <= seg_count; i++) {
+                nbi_polyline_vtx(v + i, points[i * 2], points[i * 2 + 1], color);
+        }
+
+        data->vtx_count += seg_count + 1;
+        data->idx_count += seg_count * 2;
+
+        nbi_cmd_end(data, cmd);
+}
+
+
+struct nbi_text_out {
+        struct nbi_font *font;
+
+        float start_x;
+        float end_x;
+        float max_x;
+        float x;
+        float y;
+        float space;
+
+        uint32_t align_type;
+};
+
+
+/* how far a line ending at `x` moves to be aligned, in whole pixels */
+static float
+nbi_align_offset(uint32_t align_type, float end_x, float x) {
+        if(align_type == NB_TEXT_ALIGN_LEFT) {
+                return 0.0f;
+        }
+
+        float offset = end_x - x;
+        if(offset < 0.0f) {
+                offset = 0.0f;
+        }
+        if(align_type == NB_TEXT_ALIGN_CENTER) {
+                offset *= 0.5f;
+        }
+        return (float)((int)offset);
+}
+
+
+static void
+nbi_line_adv(struct nbi_text_out * out) {
+        if(out->x > out->max_x) {
+                out->max_x = out->x;
+        }
+
+        out->x = out->start_x;
+        out->y += out->font->height;
+        out->space = 0.0f;
+}
+
+
+/* where the glyphs of a text go, split onto a new base vertex as needed */
+struct nbi_text_emit {
+        struct nbr_cmd_buf *chunk;
+        struct nbr_vtx_buf *data;
+        struct nbr_cmd *cmd;
+        nbr_idx vtx;
+        const struct nb_rect *clip;
+        uint32_t color;
+};
+
+
+static void
+nbi_text_emit_glyph(struct nbi_text_emit *emit, const stbtt_aligned_quad *q, float dx) {
+        emit->cmd = nbi_cmd_split(emit->chunk, emit->data, emit->cmd, 4, &emit->vtx);
+        emit->vtx += nbi_push_glyph(emit->data, emit->vtx, q, dx, emit->clip, emit->color);
+}
+
+
+/*
+ * Emits the first `count` glyphs of `text[it, end)` from `x`, scaled about
+ * the start of the line and the baseline, then moved along by `dx`.
+ */
+static float
+nbi_text_emit_run(
+        struct nbi_font *font,
+        struct nbi_text_emit *emit,
+        const char *it,
+        const char *end,
+        float x,
+        float y,
+        float scale,
+        uint32_t count,
+        float dx)
+{
+        float x0 = x;
+        float space = 0.0f;
+
+        while(it < end && count) {
+                if(*it == ' ') {
+                        space += font->space_width;
+                        it += 1;
+                        continue;
+                }
+
+                uint32_t cp;
+                it += nbi_decode_utf8_cp((char *)it, &cp);
+
+                if(!nbi_char_valid(font, cp)) {
+                        continue;
+                }
+
+                x += space;
+                space = 0.0f;
+
+                float gy = y;
+                stbtt_aligned_quad q;
+                nbi_get_glyph_quad(font, cp, &x, &gy, &q);
+
+                if(scale != 1.0f) {
+                        q.x0 = x0 + (q.x0 - x0) * scale;
+                        q.x1 = x0 + (q.x1 - x0) * scale;
+                        q.y0 = y + (q.y0 - y) * scale;
+                        q.y1 = y + (q.y1 - y) * scale;
+                }
+
+                nbi_text_emit_glyph(emit, &q, dx);
+                count--;
+        }
+
+        return x;
+}
+
+
+/*
+ * Fits each line of unwrapped text to the rect. Glyph end positions are
+ * collected until the line overflows, the cut is a binary search over
+ * them, and only the glyphs that stay are emitted.
+ */
+static void
+nbi_text_fit(
+        struct nbi_font *font,
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect,
+        uint32_t flags,
+        uint32_t color,
+        const char *text)
+{
+        uint32_t align = flags & _NB_TEXT_ALIGN_BIT_MASK;
+        float start_x = (float)rect.x;
+        float end_x = (float)rect.x + (float)rect.w;
+        float y = (float)rect.y + font->ascent;
+
+        const char *end = text + strlen(text);
+        if(flags & NBI_TEXT_FLAGS_TERM) {
+                const char *tag = strstr(text, "##");
+                if(tag) {
+                        end = tag;
+                }
+        }
+
+        /* every byte a glyph at most, plus the ellipsis */
+        uint32_t glyph_max = (uint32_t)(end - text) + 3;
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, glyph_max * 4, glyph_max * 6);
+
+        struct nbi_text_emit emit;
+        emit.chunk = chunk;
+        emit.data = &chunk->vtx_buf;
+        emit.cmd = nbi_cmd_begin(chunk, emit.data, NBR_CMD_TYPE_TRIANGLES, 4, &emit.vtx);
+        emit.clip = nbi_clip_top(buf);
+        emit.color = color;
+
+        float dot_width = nbi_get_glyph_adv(font, '.');
+        float ellipsis_width = nbi_char_valid(font, '.') ? dot_width * 3.0f : 0.0f;
+
+        /* where a line that overflows is cut */
+        float limit = end_x;
+        if(flags & NBI_TEXT_FLAGS_ELLIPSIS) {
+                limit -= ellipsis_width;
+        }
+
+        const char *line = text;
+        while(line <= end) {
+                const char *nl = (const char *)memchr(line, '\n', (size_t)(end - line));
+                const char *line_end = nl ? nl : end;
+
+                /* measure up to the first glyph past the width, and the glyphs ending inside the limit */
+                uint32_t count = 0;
+                uint32_t fit_count = 0;
+                float fit_x = start_x;
+                uint32_t overflow = 0;
+                float x = start_x;
+                float space = 0.0f;
+                const char *it = line;
+
+                while(it < line_end) {
+                        if(*it == ' ') {
+                                space += font->space_width;
+                                it += 1;
+                                continue;
+                        }
+
+                        uint32_t cp;
+                        it += nbi_decode_utf8_cp((char *)it, &cp);
+
+                        if(!nbi_char_valid(font, cp)) {
+                                continue;
+                        }
+
+                        x += space;
+                        x += nbi_get_glyph_adv(font, cp);
+                        space = 0.0f;
+
+                        count++;
+
+                        /* advances only grow, so the glyphs that fit are a prefix */
+                        if(x <= limit) {
+                                fit_count = count;
+                                fit_x = x;
+                        }
+
+                        if(x > end_x) {
+                                overflow = 1;
+                                if(!(flags & NBI_TEXT_FLAGS_SHRINK)) {
+                                        break;
+                                }
+                        }
+                }
+
+                /* nbr_text commits pending spaces in front of the tag */
+                if(!overflow && line_end == end && *end == '#') {
+                        x += space;
+                }
+
+                float scale = 1.0f;
+                float ellipsis_x = 0.0f;
+                uint32_t keep = count;
+
+                if(overflow && (flags & NBI_TEXT_FLAGS_SHRINK)) {
+                        scale = (float)rect.w / (x - start_x);
+                }
+                else if(overflow) {
+                        keep = fit_count;
+                        ellipsis_x = fit_x;
+                }
+
+                /* where the line ends is known up front, so it is emitted in place */
+                float line_x = x;
+                if(overflow && (flags & NBI_TEXT_FLAGS_SHRINK)) {
+                        line_x = end_x;
+                }
+                else if(overflow) {
+                        line_x = ellipsis_x;
+                        if((flags & NBI_TEXT_FLAGS_ELLIPSIS) && nbi_char_valid(font, '.')) {
+                                uint32_t k;
+                                for(k = 0; k < 3; k++) {
+                                        line_x += dot_width;
+                                }
+                        }
+                }
+
+                float dx = nbi_align_offset(align, end_x, line_x);
+                nbi_text_emit_run(font, &emit, line, line_end, start_x, y, scale, keep, dx);
+
+                if(overflow && !(flags & NBI_TEXT_FLAGS_SHRINK) && (flags & NBI_TEXT_FLAGS_ELLIPSIS)) {
+                        static const char dots[] = "...";
+                        nbi_text_emit_run(font, &emit, dots, dots + 3, ellipsis_x, y, 1.0f, 3, dx);
+                }
+
+                if(!nl) {
+                        break;
+                }
+
+                line = nl + 1;
+                y += font->height;
+        }
+
+        nbi_cmd_end(emit.data, emit.cmd);
+}
+
+
+/* a place in a text, which can be in the middle of a word */
+struct nbi_text_pos {
+        const char *it;
+        const char *word_end;               /* end of the word `it` is in, or 0 */
+        const char *word_next;              /* where the text goes on after that word */
+        uint32_t forced;                    /* the glyph at `it` stays on the line it starts */
+};
+
+
+/*
+ * Lays out the line of text at `pos`, emitting its glyphs moved along by
+ * `dx` when there is somewhere to emit them. Returns nonzero if another line
+ * follows, with `pos` at its start. Either way out->x is left at the end of
+ * the line, before nbi_line_adv.
+ */
+static uint32_t
+nbi_text_line(
+        struct nbi_text_out *out,
+        struct nbi_text_pos *pos,
+        uint32_t flags,
+        struct nbi_text_emit *emit,
+        float dx)
+{
+        struct nbi_font *font = out->font;
+        uint32_t wrap = flags & NBI_TEXT_FLAGS_WRAP;
+        uint32_t term_tag = flags & NBI_TEXT_FLAGS_TERM;
+        const char *it = pos->it;
+
+        while(1) {
+                if(pos->word_end) {
+                        /* a glyph that overflows goes on the next line, whatever its width */
+                        while(it < pos->word_end) {
+                                uint32_t cp;
+                                uint32_t cp_size = nbi_decode_utf8_cp((char *)it, &cp);
+
+                                float prev_x = out->x;
+
+                                stbtt_aligned_quad q;
+                                nbi_get_glyph_quad(font, cp, &out->x, &out->y, &q);
+
+                                if(wrap && out->x > out->end_x && !pos->forced) {
+                                        out->x = prev_x;
+                                        pos->it = it;
+                                        pos->forced = 1;
+                                        return 1;
+                                }
+
+                                pos->forced = 0;
+                                if(emit) {
+                                        nbi_text_emit_glyph(emit, &q, dx);
+                                }
+                                it += cp_size;
+                        }
+
+                        it = pos->word_next;
+                        pos->word_end = 0;
+                        continue;
+                }
+
+                if(!*it) {
+                        break;
+                }
+
+                if(*it == '\n') {
+                        pos->it = it + 1;
+                        return 1;
+                }
+
+                if(*it == ' ') {
+                        out->space += font->space_width;
+                        it += 1;
+                        continue;
+                }
+
+                uint32_t cp;
+                uint32_t cp_size = nbi_decode_utf8_cp((char *)it, &cp);
+
+                if(!nbi_char_valid(font, cp)) {
+                        it += cp_size;
+                        continue;
+                }
+
+                const char *word = it;
+                const char *word_end = 0;
+                while(*it && *it != '\n' && *it != ' ') {
+                        if(term_tag && strncmp(it, "##", 2) == 0) {
+                                word_end = it;
+                                it += strlen(it);
+                                break;
+                        }
+
+                        uint32_t word_cp;
+                        uint32_t word_cp_size = nbi_decode_utf8_cp((char *)it, &word_cp);
+                        if(!nbi_char_valid(font, word_cp)) {
+                                break;
+                        }
+
+                        it += word_cp_size;
+                }
+
+                if(!word_end) {
+                        word_end = it;
+                }
+
+                if(wrap && out->x > out->start_x) {
+                        float word_x = out->x + out->space;
+                        const char *p;
+                        for(p = word; p < word_end;) {
+                                uint32_t word_cp;
+                                p += nbi_decode_utf8_cp((char *)p, &word_cp);
+                                word_x += nbi_get_glyph_adv(font, word_cp);
+                        }
+                        if(word_x > out->end_x) {
+                                pos->it = word;
+                                return 1;
+                        }
+                }
+
+                out->x += out->space;
+                out->space = 0.0f;
+
+                pos->word_end = word_end;
+                pos->word_next = it;
+                it = word;
+        }
+
+        if(flags & NBI_TEXT_FLAGS_CURSOR) {
+                float cursor_width = 1.0f;
+                float prev_x = out->x;
+
+                out->x += out->space;
+                if(wrap && out->x > out->start_x && out->x + cursor_width > out->end_x) {
+                        out->x = prev_x;
+                        pos->it = it;
+                        return 1;
+                }
+
+                if(emit) {
+                        stbtt_aligned_quad q = { 0 };
+                        q.x0 = out->x;
+                        q.y0 = out->y - font->ascent;
+                        q.x1 = out->x + cursor_width;
+                        q.y1 = q.y0 + font->height;
+                        nbi_text_emit_glyph(emit, &q, dx);
+                }
+
+                out->x += cursor_width;
+        }
+
+        pos->it = it;
+        return 0;
+}
+
+
+void
+nbr_text_(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        struct nbi_font *font,
+        struct nb_rect rect,
+        uint32_t flags,
+        uint32_t color,
+        const char *text,
+        float *out_size)
+{
+        if(!text) {
+                if(out_size) {
+                        out_size[0] = 0.0f;
+                        out_size[1] = font->height;
+                }
+
+                return;
+        }
+
+        uint32_t wrap = flags & NBI_TEXT_FLAGS_WRAP;
+        uint32_t fit = !wrap && !(flags & NBI_TEXT_FLAGS_CURSOR) && (flags & _NBI_TEXT_FLAGS_FIT_MASK) && rect.w > 0;
+
+        /*
+         * Lines never start left of the rect and run down from its top,
+         * fitted text also stays inside its width and unwrapped text is a
+         * line per newline tall. Glyphs overhang by less than a line.
+         */
+        if(buf && !out_size) {
+                struct nbi_cull cull;
+                nbi_cull_init(ctx, buf, 1, &cull);
+
+                float x0 = (float)rect.x;
+                float y0 = (float)rect.y;
+                float x1 = fit ? x0 + (float)rect.w : 1e30f;
+                float y1 = 1e30f;
+
+                if(!wrap && cull.active) {
+                        uint32_t line_count = 1;
+                        const char *nl = text;
+                        while((nl = strchr(nl, '\n')) != 0) {
+                                line_count++;
+                                nl++;
+                        }
+                        y1 = y0 + font->height * (float)line_count;
+                }
+
+                if(nbi_culled(&cull, x0, y0, x1, y1, font->height)) {
+                        return;
+                }
+        }
+
+        if(buf && fit) {
+                nbi_text_fit(font, buf, rect, flags, color, text);
+                return;
+        }
+
+        struct nbi_text_out out = { 0 };
+        out.font = font;
+        out.start_x = (float)rect.x;
+        out.end_x = (float)rect.x + (float)rect.w;
+        out.max_x = (float)rect.x;
+        out.x = (float)rect.x;
+        out.y = (float)rect.y + font->ascent;
+        out.align_type = flags & _NB_TEXT_ALIGN_BIT_MASK;
+
+        struct nbi_text_emit emit = { 0 };
+        if(buf) {
+                /* every byte a glyph at most, plus the cursor */
+                uint32_t glyph_max = (uint32_t)strlen(text) + 1;
+                emit.chunk = nbi_cmd_buf_reserve(buf, glyph_max * 4, glyph_max * 6);
+                emit.data = &emit.chunk->vtx_buf;
+                emit.cmd = nbi_cmd_begin(emit.chunk, emit.data, NBR_CMD_TYPE_TRIANGLES, 4, &emit.vtx);
+                emit.clip = nbi_clip_top(buf);
+                emit.color = color;
+        }
+
+        /*
+         * Aligned lines are laid out twice, once to find where they end and
+         * once to emit them in place, so vertices are never read back.
+         */
+        struct nbi_text_pos pos = { 0 };
+        pos.it = text;
+
+        uint32_t more = 1;
+        while(more) {
+                float dx = 0.0f;
+                if(buf && out.align_type != NB_TEXT_ALIGN_LEFT) {
+                        struct nbi_text_out line_out = out;
+                        struct nbi_text_pos line_pos = pos;
+                        nbi_text_line(&line_out, &line_pos, flags, 0, 0.0f);
+                        dx = nbi_align_offset(out.align_type, out.end_x, line_out.x);
+                }
+
+                more = nbi_text_line(&out, &pos, flags, buf ? &emit : 0, dx);
+                nbi_line_adv(&out);
+        }
+
+        if(out_size) {
+                out_size[0] = out.max_x - rect.x;
+                out_size[1] = out.y - (rect.y + font->ascent);
+        }
+
+        if(buf) {
+                nbi_cmd_end(emit.data, emit.cmd);
+        }
+}
+
+/*
+ * Length of the run of plain ascii at `it`, that is no control or multibyte
+ * chars, and no '#' if a term tag could start there. Spaces are only part of
+ * the run with `spaces` set.
+ */
+static uint32_t
+nbi_text_plain_run(
+        const char *it,
+        const char *end,
+        uint32_t term_tag,
+        uint32_t spaces)
 {
-        if((buf->idx_count + 6) <= buf->idx_count_max) {
-                buf->idx[buf->idx_count++] = top_lft;
-                buf->idx[buf->idx_count++] = bot_lft;
-                buf->idx[buf->idx_count++] = bot_rgt;
+        const char *start = it;
+        unsigned char first = spaces ? ' ' : ' ' + 1;
+
+#if NBR_SIMD_SSE2
+        /* signed compares, so bytes from 0x80 up fail the lower bound */
+        const __m128i lo = _mm_set1_epi8((char)(first - 1));
+        const __m128i hi = _mm_set1_epi8(0x7F);
+        const __m128i tag = _mm_set1_epi8(term_tag ? '#' : 0x7F);
+
+        while(end - it >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)it);
+                __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+                plain = _mm_andnot_si128(_mm_cmpeq_epi8(v, tag), plain);
+
+                uint32_t stop = ~(uint32_t)_mm_movemask_epi8(plain) & 0xFFFF;
+                if(stop) {
+                        while(!(stop & 1)) {
+                                stop >>= 1;
+                                it++;
+                        }
+                        return (uint32_t)(it - start);
+                }
+
+                it += 16;
+        }
+#endif
+
+        while(it < end) {
+                unsigned char c = (unsigned char)*it;
+                if(c < first || c >= 0x7F || (term_tag && c == '#')) {
+                        break;
+                }
+                it++;
+        }
+
+        return (uint32_t)(it - start);
+}
 
-                buf->idx[buf->idx_count++] = top_lft;
-                buf->idx[buf->idx_count++] = bot_rgt;
-                buf->idx[buf->idx_count++] = top_rgt;
+
+static float
+nbi_text_next_adv(
+        struct nbi_font *font,
+        const char **it)
+{
+        uint32_t cp = (unsigned char)**it;
+
+        if(cp < 0x80) {
+                *it += 1;
         }
         else {
-                NB_ASSERT(!"nbi_push_quad_idxs: vtx buf full!");
+                *it += nbi_decode_utf8_cp((char *)*it, &cp);
         }
+
+        return nbi_get_glyph_adv(font, cp);
 }
 
-static nbr_idx
-nbi_push_quad(
-        struct nbr_vtx_buf *buf,
-        nbr_idx vtx,
-        float *rect,
-        uint32_t color)
+
+/*
+ * Without wrapping words don't matter, pending spaces go in front of the
+ * next valid glyph, which is what the word loop in `nbi_text_measure` ends
+ * up doing too.
+ */
+static void
+nbi_text_measure_nowrap(
+        struct nbi_font *font,
+        uint32_t flags,
+        const char *it,
+        const char *end,
+        float *out_size)
 {
-        nbi_push_quad_idxs(buf, vtx, vtx + 1, vtx + 2, vtx + 3);
-        nbi_push_vtx(buf, rect[0], rect[1], color);
-        nbi_push_vtx(buf, rect[0], rect[1] + rect[3], color);
-        nbi_push_vtx(buf, rect[0] + rect[2], rect[1] + rect[3], color);
-        nbi_push_vtx(buf, rect[0] + rect[2], rect[1], color);
-        return 4;
+        uint32_t term_tag = flags & NBI_TEXT_FLAGS_TERM;
+        uint32_t ascii_fast = font->ascii_fast;
+        const float *adv = font->ascii_adv;
+        float space_width = font->space_width;
+
+        float max_x = 0.0f;
+        float x = 0.0f;
+        float y = font->ascent;
+        float space = 0.0f;
+
+        while(it < end) {
+                if(ascii_fast && end - it >= 16) {
+                        uint32_t run = nbi_text_plain_run(it, end, term_tag, 1);
+                        const char *run_end = it + run;
+
+                        while(it < run_end) {
+                                unsigned char c = (unsigned char)*it++;
+                                if(c == ' ') {
+                                        space += space_width;
+                                        continue;
+                                }
+                                if(space != 0.0f) {
+                                        x += space;
+                                        space = 0.0f;
+                                }
+                                x += adv[c];
+                        }
+
+                        if(run) {
+                                continue;
+                        }
+                }
+
+                unsigned char c = (unsigned char)*it;
+
+                if(ascii_fast && c > ' ' && c < 0x7F && !(term_tag && c == '#')) {
+                        if(space != 0.0f) {
+                                x += space;
+                                space = 0.0f;
+                        }
+                        x += adv[c];
+                        it += 1;
+                }
+                else if(c == ' ') {
+                        space += space_width;
+                        it += 1;
+                }
+                else if(c == '\n') {
+                        if(x > max_x) {
+                                max_x = x;
+                        }
+                        x = 0.0f;
+                        y += font->height;
+                        space = 0.0f;
+                        it += 1;
+                }
+                else if(term_tag && strncmp(it, "##", 2) == 0 && nbi_char_valid(font, '#')) {
+                        x += space;
+                        space = 0.0f;
+                        it = end;
+                }
+                else {
+                        uint32_t cp;
+                        it += nbi_decode_utf8_cp((char *)it, &cp);
+
+                        if(nbi_char_valid(font, cp)) {
+                                x += space;
+                                space = 0.0f;
+                                x += nbi_get_glyph_adv(font, cp);
+                        }
+                }
+        }
+
+        if(flags & NBI_TEXT_FLAGS_CURSOR) {
+                x += space;
+                x += 1.0f;
+        }
+
+        if(x > max_x) {
+                max_x = x;
+        }
+        y += font->height;
+
+        out_size[0] = max_x;
+        out_size[1] = y - font->ascent;
 }
 
-static uint32_t
-nbi_push_round_corner(
-        struct nbr_vtx_buf *buf,
-        float px,
-        float py,
-        uint32_t color,
-        nbr_idx seg_count,
-        uint32_t radius, float angle)
+
+/*
+ * Measure only version of `nbr_text_`, it follows the same wrapping rules
+ * but sums cached advances instead of building quads, so the sizes match
+ * the layout exactly.
+ */
+static void
+nbi_text_measure(
+        struct nbi_font *font,
+        float width,
+        uint32_t flags,
+        const char *text,
+        float *out_size)
 {
-        uint32_t result = 0;
-        if(seg_count) {
-                nbr_idx i;
+        if(!text) {
+                out_size[0] = 0.0f;
+                out_size[1] = font->height;
+                return;
+        }
 
-                nbr_idx vtx = (nbr_idx)buf->vtx_count;
+        uint32_t wrap = flags & NBI_TEXT_FLAGS_WRAP;
+        uint32_t term_tag = flags & NBI_TEXT_FLAGS_TERM;
 
-                for(i = 0; i < seg_count; i++) {
-                        nbi_push_idx(buf, vtx);
-                        nbi_push_idx(buf, vtx + (i + 1));
-                        nbi_push_idx(buf, vtx + (i + 2));
+        if(!wrap) {
+                nbi_text_measure_nowrap(font, flags, text, text + strlen(text), out_size);
+
+                float fit_width = (float)(int)width;
+                if((flags & _NBI_TEXT_FLAGS_FIT_MASK) && fit_width > 0.0f && out_size[0] > fit_width) {
+                        out_size[0] = fit_width;
+                }
+                return;
+        }
+
+        /* nbr_text_ lays out in an int rect */
+        struct nbi_text_out out = { 0 };
+        out.font = font;
+        out.end_x = (float)(int)width;
+        out.y = font->ascent;
+
+        const char *it = text;
+        const char *end = text + strlen(text);
+        const char *p;
+
+        while(it < end) {
+                char c = *it;
+
+                if(c == '\n') {
+                        nbi_line_adv(&out);
+                        it += 1;
+                        continue;
+                }
+
+                if(c == ' ') {
+                        out.space += font->space_width;
+                        it += 1;
+                        continue;
+                }
+
+                uint32_t cp;
+                uint32_t cp_size = nbi_decode_utf8_cp((char *)it, &cp);
+
+                if(!nbi_char_valid(font, cp)) {
+                        it += cp_size;
+                        continue;
+                }
+
+                /* find the word */
+                const char *word = it;
+                const char *word_end = 0;
+
+                while(it < end && *it != '\n' && *it != ' ') {
+                        if(font->ascii_fast) {
+                                uint32_t run = nbi_text_plain_run(it, end, term_tag, 0);
+                                if(run) {
+                                        it += run;
+                                        continue;
+                                }
+                        }
+
+                        if(term_tag && strncmp(it, "##", 2) == 0) {
+                                word_end = it;
+                                it = end;
+                                break;
+                        }
+
+                        uint32_t word_cp;
+                        uint32_t word_cp_size = nbi_decode_utf8_cp((char *)it, &word_cp);
+                        if(!nbi_char_valid(font, word_cp)) {
+                                break;
+                        }
+
+                        it += word_cp_size;
+                }
+
+                if(!word_end) {
+                        word_end = it;
+                }
+
+                if(out.x > 0.0f) {
+                        float word_x = out.x + out.space;
+                        for(p = word; p < word_end;) {
+                                word_x += nbi_text_next_adv(font, &p);
+                        }
+                        if(word_x > out.end_x) {
+                                nbi_line_adv(&out);
+                        }
+                }
+
+                out.x += out.space;
+                out.space = 0.0f;
+
+                for(p = word; p < word_end;) {
+                        float adv = nbi_text_next_adv(font, &p);
+                        float prev_x = out.x;
+
+                        out.x += adv;
+                        if(out.x > out.end_x) {
+                                out.x = prev_x;
+                                nbi_line_adv(&out);
+                                out.x += adv;
+                        }
+                }
+        }
+
+        if(flags & NBI_TEXT_FLAGS_CURSOR) {
+                float cursor_width = 1.0f;
+                float prev_x = out.x;
+
+                out.x += out.space;
+                if(out.x > 0.0f && out.x + cursor_width > out.end_x) {
+                        out.x = prev_x;
+                        nbi_line_adv(&out);
+                }
+
+                out.x += cursor_width;
+        }
+
+        nbi_line_adv(&out);
+
+        out_size[0] = out.max_x;
+        out_size[1] = out.y - font->ascent;
+}
+
+
+void
+nbr_get_text_size(
+        struct nb_renderer_ctx * ctx,
+        uint32_t font_idx,
+        float width,
+        uint32_t flags,
+        const char *text,
+        float *out_size)
+{
+        if(!ctx || !out_size) {
+                NB_ASSERT(!"Invalid params");
+                return;
+        }
+
+        struct nbi_font * font = nbi_font_get(ctx, font_idx);
+        if(!font) {
+                out_size[0] = 0.0f;
+                out_size[1] = 0.0f;
+                return;
+        }
+
+        nbi_text_measure(font, width, flags, text, out_size);
+}
+
+
+void
+nbr_get_text_size_batch(
+        struct nb_renderer_ctx * ctx,
+        uint32_t font_idx,
+        float width,
+        uint32_t flags,
+        const char **strs,
+        uint32_t count,
+        float *out_sizes)
+{
+        if(!ctx || (count && (!strs || !out_sizes))) {
+                NB_ASSERT(!"Invalid params");
+                return;
+        }
+
+        struct nbi_font * font = nbi_font_get(ctx, font_idx);
+        uint32_t i;
+
+        for(i = 0; i < count; i++) {
+                if(!font) {
+                        out_sizes[i * 2 + 0] = 0.0f;
+                        out_sizes[i * 2 + 1] = 0.0f;
+                        continue;
                 }
 
-                nbi_push_vtx(buf, px, py, color);
+                nbi_text_measure(font, width, flags, strs[i], out_sizes + i * 2);
+        }
+}
+
+
+void
+nbr_text(
+        struct nb_renderer_ctx *ctx,
+        struct nbr_cmd_buf *buf,
+        uint32_t font_idx,
+        struct nb_rect rect,
+        uint32_t flags,
+        uint32_t color,
+        const char *text)
+{
+        struct nbi_font *font = nbi_font_get(ctx, font_idx);
+        if(!font) {
+                return;
+        }
+
+        nbr_text_(ctx, buf, font, rect, flags, color, text, 0);
+}
+
+
+/*
+ * Records a scissor unless it matches the last one, and replaces a scissor
+ * that nothing was drawn under.
+ */
+static void
+nbi_scissor(struct nbr_cmd_buf *buf, int16_t x, int16_t y, int16_t w, int16_t h) {
+        if(!buf) {
+                NB_ASSERT(!"nbi_scissor: cmd buf is null!");
+                return;
+        }
+
+        if(buf->scissor_valid &&
+                buf->scissor[0] == x && buf->scissor[1] == y &&
+                buf->scissor[2] == w && buf->scissor[3] == h)
+        {
+                buf->scissor_dropped_count += 1;
+                return;
+        }
+
+        struct nbr_cmd_buf *chunk = nbi_cmd_buf_reserve(buf, 0, 0);
+        struct nbr_cmd *cmd = chunk->cmd_count ? chunk->cmds + chunk->cmd_count - 1 : 0;
+        if(cmd && cmd->type == NBR_CMD_TYPE_SCISSOR) {
+                buf->scissor_dropped_count += 1;
+        }
+        else {
+                cmd = nbi_cmd_push(chunk);
+        }
+
+        if(cmd) {
+                cmd->type = NBR_CMD_TYPE_SCISSOR;
+                cmd->data.clip_rect[0] = x;
+                cmd->data.clip_rect[1] = y;
+                cmd->data.clip_rect[2] = w;
+                cmd->data.clip_rect[3] = h;
+
+                buf->scissor[0] = x;
+                buf->scissor[1] = y;
+                buf->scissor[2] = w;
+                buf->scissor[3] = h;
+                buf->scissor_valid = 1;
+        }
+}
+
+
+void
+nbr_scissor_set(
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect)
+{
+        nbi_scissor(buf, (int16_t)rect.x, (int16_t)rect.y, (int16_t)rect.w, (int16_t)rect.h);
+}
+
+
+void
+nbr_scissor_clear(struct nbr_cmd_buf *buf) {
+        nbi_scissor(buf, 0, 0, 0x7FFF, 0x7FFF);
+}
+
+
+void
+nbr_clip_push(
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect)
+{
+        if(!buf) {
+                NB_ASSERT(!"nbr_clip_push: cmd buf is null!");
+                return;
+        }
+
+        if(buf->clip_count >= NBR_CLIP_STACK_MAX) {
+                NB_ASSERT(!"nbr_clip_push: clip stack full!");
+                return;
+        }
+
+        const struct nb_rect *top = nbi_clip_top(buf);
+        if(top) {
+                nbi_clip_rect(top, &rect);
+        }
 
-                float d_angle = ((float)NB_TAU * 0.25f) / (float)seg_count;
+        buf->clip_stack[buf->clip_count++] = rect;
+}
 
-                for(i = 0; i < (seg_count + 1); i++) {
-                        float t = angle + d_angle * (float)i;
-                        float x = px + cosf(t) * (float)radius;
-                        float y = py - sinf(t) * (float)radius;
-                        nbi_push_vtx(buf, x, y, color);
-                }
 
-                result = seg_count + 2;
+void
+nbr_clip_pop(struct nbr_cmd_buf *buf) {
+        if(!buf) {
+                NB_ASSERT(!"nbr_clip_pop: cmd buf is null!");
+                return;
         }
-        else {
-                NB_ASSERT(!"nbi_push_round_corner: trying to push a corner with no segments!");
+
+        if(!buf->clip_count) {
+                NB_ASSERT(!"nbr_clip_pop: clip stack empty!");
+                return;
         }
-        return result;
+
+        buf->clip_count -= 1;
 }
 
 
-uint32_t
-nb_get_font_count(
-        struct nb_renderer_ctx * ctx)
+void
+nbr_callback(
+        struct nbr_cmd_buf *buf,
+        nbr_draw_callback_fn fn,
+        void *user_data)
 {
-        NB_ASSERT(ctx);
-        return ctx->font_count;
+        if(!buf || !fn) {
+                NB_ASSERT(!"nbr_callback: NB_INVALID_PARAMS");
+                return;
+        }
+
+        struct nbr_cmd *cmd = nbi_cmd_push(nbi_cmd_buf_reserve(buf, 0, 0));
+        if(cmd) {
+                cmd->type = NBR_CMD_TYPE_CALLBACK;
+                cmd->data.callback.fn = fn;
+                cmd->data.callback.user_data = user_data;
+        }
 }
 
+
 nb_result
-nb_get_font_tex_list(
+nb_debug_set_font(
         struct nb_renderer_ctx * ctx,
-        struct nb_font_tex * tex_list)
+        uint32_t idx)
 {
         NB_ASSERT(ctx);
-        NB_ASSERT(tex_list);
+        NB_ASSERT(idx < ctx->font_count);
 
-        uint32_t i;
-        for(i = 0; i < ctx->font_count; i++) {
-                tex_list[i] = ctx->fonts[i].tex;
-        }
+        ctx->debug_font_next = ctx->fonts + idx;
 
         return NB_OK;
 }
 
 
-static uint32_t
-nbi_decode_utf8_cp(
-        char *utf8,
-        uint32_t *cp)
-{
-        *cp = 0;
+/* ----------------------------------------------------------- Text Layout -- */
 
-        uint8_t *it = (uint8_t *)utf8;
-        uint8_t byte = *it++;
-        if((byte & 0x80) == 0) {
-                *cp = (uint32_t)byte;
+
+struct nbi_layout_line {
+        uint32_t byte_start;
+        uint32_t glyph_start;
+        uint32_t glyph_count;
+        uint32_t hard;                      /* first line of a paragraph */
+        float width;
+};
+
+
+/* quads are line local, the baseline sits at the font ascent */
+struct nbi_layout_glyph {
+        float x0, y0, x1, y1;
+        float s0, t0, s1, t1;
+};
+
+
+struct nbi_layout_lines {
+        struct nbi_layout_line *lines;
+        uint32_t line_count;
+        uint32_t line_cap;
+
+        struct nbi_layout_glyph *glyphs;
+        uint32_t glyph_count;
+        uint32_t glyph_cap;
+};
+
+
+struct nbr_text_layout {
+        struct nb_renderer_ctx *ctx;
+        uint32_t font;
+        uint32_t flags;
+        float width;
+
+        /* what the glyphs were built against */
+        uint32_t generation;
+        float font_height;
+
+        char *text;
+        uint32_t text_len;
+        uint32_t text_cap;
+
+        struct nbi_layout_lines cur;
+        struct nbi_layout_lines tmp;        /* lines being relaid out */
+};
+
+
+static int
+nbi_layout_reserve(
+        void **arr,
+        uint32_t *cap,
+        uint32_t count,
+        size_t elem_size)
+{
+        if(count <= *cap) {
+                return 1;
         }
-        else if((byte & 0xE0) == 0xC0) {
-                *cp =  (byte  & 0x1F) << 6;
-                *cp |= (*it++ & 0x3F);
+
+        uint32_t new_cap = *cap ? *cap : 64;
+        while(new_cap < count) {
+                new_cap *= 2;
         }
-        else if((byte & 0xF0) == 0xE0) {
-                *cp =  (byte  & 0x0F) << 12;
-                *cp |= (*it++ & 0x3F) << 6;
-                *cp |= (*it++ & 0x3F);
+
+        void *mem = NB_ALLOC(elem_size * new_cap);
+        if(!mem) {
+                NB_ASSERT(!"nbi_layout_reserve: failed to allocate");
+                return 0;
         }
-        else if((byte & 0xF8) == 0xF0) {
-                *cp =  (byte  & 0x07) << 18;
-                *cp |= (*it++ & 0x3F) << 12;
-                *cp |= (*it++ & 0x3F) << 6;
-                *cp |= (*it++ & 0x3F);
+
+        if(*arr) {
+                memcpy(mem, *arr, elem_size * *cap);
+                NB_FREE(*arr);
         }
 
-        uint32_t result = (uint32_t)((char *)it - utf8);
-        return result;
+        *arr = mem;
+        *cap = new_cap;
+
+        return 1;
 }
 
 
-/* ------------------------------------------------------- Render Commands -- */
+static struct nbi_layout_line *
+nbi_layout_push_line(
+        struct nbi_layout_lines *dst,
+        uint32_t byte_start,
+        uint32_t hard)
+{
+        if(!nbi_layout_reserve((void **)&dst->lines, &dst->line_cap, dst->line_count + 1, sizeof(*dst->lines))) {
+                return 0;
+        }
 
+        struct nbi_layout_line *line = dst->lines + dst->line_count++;
+        line->byte_start = byte_start;
+        line->glyph_start = dst->glyph_count;
+        line->glyph_count = 0;
+        line->hard = hard;
+        line->width = 0.0f;
 
-uint32_t
-nbr_cmd_buf_get_size(struct nbr_cmd_limits lim) {
-        uint32_t result = sizeof(struct nbr_cmd_buf);
-        result += sizeof(struct nbr_cmd) * lim.cmd_count_max;
-        result += sizeof(struct nbr_vtx) * lim.vtx_count_max;
-        result += sizeof(nbr_idx) * lim.idx_count_max;
-        return result;
+        return line;
 }
 
 
-nb_result
-nbr_cmd_buf_init(struct nbr_cmd_buf **out_buf, struct nbr_cmd_limits lim, void *mem) {
-        nb_result result = NB_OK;
-        if(out_buf && mem) {
-                uint8_t *ptr = (uint8_t *)mem;
+/*
+ * Lays out one paragraph, `text[start, end)` holds no newlines. Follows the
+ * same word wrapping as `nbr_text_` so retained and immediate text agree.
+ */
+static int
+nbi_layout_paragraph(
+        struct nbr_text_layout *layout,
+        struct nbi_font *font,
+        struct nbi_layout_lines *dst,
+        uint32_t start,
+        uint32_t end)
+{
+        uint32_t wrap = layout->flags & NBI_TEXT_FLAGS_WRAP;
+        char *text = layout->text;
 
-                struct nbr_cmd_buf *buf = (struct nbr_cmd_buf *)ptr;
-                ptr += sizeof(struct nbr_cmd_buf);
+        struct nbi_layout_line *line = nbi_layout_push_line(dst, start, 1);
+        if(!line) {
+                return 0;
+        }
 
-                buf->cmds = (struct nbr_cmd *)ptr;
-                ptr += sizeof(struct nbr_cmd) * lim.cmd_count_max;
-                buf->cmd_count = 0;
-                buf->cmd_count_max = lim.cmd_count_max;
+        float x = 0.0f;
+        float space = 0.0f;
+        uint32_t it = start;
 
-                buf->vtx_buf.vtx = (struct nbr_vtx *)ptr;
-                ptr += sizeof(struct nbr_vtx) * lim.vtx_count_max;
-                buf->vtx_buf.vtx_count = 0;
-                buf->vtx_buf.vtx_count_max = lim.vtx_count_max;
+        while(it < end) {
+                if(text[it] == ' ') {
+                        space += font->space_width;
+                        it += 1;
+                        continue;
+                }
 
-                buf->vtx_buf.idx = (nbr_idx *)ptr;
-                ptr += sizeof(nbr_idx) * lim.idx_count_max;
-                buf->vtx_buf.idx_count = 0;
-                buf->vtx_buf.idx_count_max = lim.idx_count_max;
+                uint32_t cp;
+                uint32_t cp_size = nbi_decode_utf8_cp(text + it, &cp);
 
-                *out_buf = buf;
-        }
-        else {
-                NB_ASSERT(!"nbr_cmd_buf_init: NB_INVALID_PARAMS");
-                result = NB_INVALID_PARAMS;
-        }
-        return result;
-}
+                if(!nbi_char_valid(font, cp)) {
+                        it += cp_size;
+                        continue;
+                }
 
+                uint32_t word = it;
+                while(it < end && text[it] != ' ') {
+                        uint32_t word_cp;
+                        uint32_t word_cp_size = nbi_decode_utf8_cp(text + it, &word_cp);
+                        if(!nbi_char_valid(font, word_cp)) {
+                                break;
+                        }
+                        it += word_cp_size;
+                }
 
-void
-nbr_cmd_buf_array_clear(struct nbr_cmd_buf **bufs, uint32_t buf_count) {
-        if(bufs && buf_count) {
                 uint32_t i;
-                for(i = 0; i < buf_count; i++) {
-                        struct nbr_cmd_buf *buf = bufs[i];
-                        if(buf) {
-                                buf->cmd_count = 0;
-                                buf->vtx_buf.vtx_count = 0;
-                                buf->vtx_buf.idx_count = 0;
+
+                if(wrap && x > 0.0f) {
+                        float word_end = x + space;
+                        for(i = word; i < it;) {
+                                uint32_t word_cp;
+                                i += nbi_decode_utf8_cp(text + i, &word_cp);
+                                word_end += nbi_get_glyph_adv(font, word_cp);
                         }
-                        else {
-                                NB_ASSERT(!"nbr_cmd_buf_array_clear: buf is null!");
+                        if(word_end > layout->width) {
+                                line->width = x;
+                                line = nbi_layout_push_line(dst, word, 0);
+                                if(!line) {
+                                        return 0;
+                                }
+                                x = 0.0f;
+                                space = 0.0f;
                         }
                 }
-        }
-}
 
+                x += space;
+                space = 0.0f;
 
-void
-nbr_cmd_buf_clear(struct nbr_cmd_buf *buf) {
-        if(buf) {
-                nbr_cmd_buf_array_clear(&buf, 1);
-        }
-}
+                if(!nbi_layout_reserve((void **)&dst->glyphs, &dst->glyph_cap, dst->glyph_count + (it - word), sizeof(*dst->glyphs))) {
+                        return 0;
+                }
 
+                for(i = word; i < it;) {
+                        uint32_t glyph_at = i;
+                        uint32_t word_cp;
+                        i += nbi_decode_utf8_cp(text + i, &word_cp);
 
-static struct nbr_cmd *
-nbi_cmd_push(struct nbr_cmd_buf *buf) {
-        struct nbr_cmd *result = 0;
-        if(buf) {
-                if(buf->cmd_count < buf->cmd_count_max) {
-                        result = buf->cmds + buf->cmd_count++;
-                        struct nbr_cmd empty_cmd = { 0 };
-                        *result = empty_cmd;
-                }
-                else {
-                        NB_ASSERT(!"nbi_cmd_push: cmd buf full!");
+                        float prev_x = x;
+                        float y = font->ascent;
+
+                        stbtt_aligned_quad q;
+                        nbi_get_glyph_quad(font, word_cp, &x, &y, &q);
+
+                        if(wrap && x > layout->width) {
+                                line->width = prev_x;
+                                line = nbi_layout_push_line(dst, glyph_at, 0);
+                                if(!line) {
+                                        return 0;
+                                }
+
+                                x = 0.0f;
+                                y = font->ascent;
+                                nbi_get_glyph_quad(font, word_cp, &x, &y, &q);
+                        }
+
+                        struct nbi_layout_glyph *g = dst->glyphs + dst->glyph_count++;
+                        g->x0 = q.x0; g->y0 = q.y0; g->x1 = q.x1; g->y1 = q.y1;
+                        g->s0 = q.s0; g->t0 = q.t0; g->s1 = q.s1; g->t1 = q.t1;
+                        line->glyph_count += 1;
                 }
         }
-        else {
-                NB_ASSERT(!"nbi_cmd_push: cmd buf is null!");
-        }
-        return result;
+
+        line->width = x;
+
+        return 1;
 }
 
 
-static struct nbr_cmd *
-nbi_cmd_begin(
-        struct nbr_cmd_buf * buf,
-        struct nbr_vtx_buf * data,
-        uint32_t type,
-        nbr_idx * vtx)
+/*
+ * Lays out `text[start, end)` paragraph by paragraph into `dst`, `end` is
+ * either the end of the text or the newline before an untouched paragraph.
+ */
+static int
+nbi_layout_range(
+        struct nbr_text_layout *layout,
+        struct nbi_font *font,
+        struct nbi_layout_lines *dst,
+        uint32_t start,
+        uint32_t end)
 {
-        struct nbr_cmd *result = nbi_cmd_push(buf);
-        if(result) {
-                result->type = type;
-                result->data.elem.offset = data->idx_count;
+        uint32_t it = start;
 
-                if(vtx) {
-                        *vtx = (nbr_idx)data->vtx_count;
-                }
-        }
-        return result;
-}
+        for(;;) {
+                const char *nl = (const char *)memchr(layout->text + it, '\n', end - it);
+                uint32_t para_end = nl ? (uint32_t)(nl - layout->text) : end;
 
-static void
-nbi_cmd_end(struct nbr_vtx_buf *data, struct nbr_cmd *cmd) {
-        if(cmd) {
-                if(data) {
-                        cmd->data.elem.count = data->idx_count - cmd->data.elem.offset;
+                if(!nbi_layout_paragraph(layout, font, dst, it, para_end)) {
+                        return 0;
                 }
-                else {
-                        NB_ASSERT(!"nbi_cmd_end: data cannot be null!");
+
+                if(!nl) {
+                        break;
                 }
+
+                it = para_end + 1;
         }
+
+        return 1;
 }
 
 
-void
-nbr_box(
-        struct nb_renderer_ctx *ctx,
-        struct nbr_cmd_buf *buf,
-        struct nb_rect rec,
-        uint32_t color,
-        uint32_t radius)
+/*
+ * Relayouts the paragraphs covering an edit, `text` already holds the new
+ * text and `cur` the old lines. Everything past the edited paragraphs only
+ * gets its offsets moved.
+ */
+static nb_result
+nbi_layout_update(
+        struct nbr_text_layout *layout,
+        uint32_t edit_start,
+        uint32_t old_edit_end,
+        int32_t delta)
 {
-        (void)ctx;
-
-        struct nbr_vtx_buf *data = &buf->vtx_buf;
+        struct nbi_layout_lines *cur = &layout->cur;
+        struct nbi_layout_lines *tmp = &layout->tmp;
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
+
+        uint32_t l0 = 0;
+        uint32_t l1 = 0;
+        uint32_t start = 0;
+
+        if(cur->line_count) {
+                /* last line starting at or before the edit, then its paragraph */
+                uint32_t lo = 0, hi = cur->line_count;
+                while(hi - lo > 1) {
+                        uint32_t mid = (lo + hi) / 2;
+                        if(cur->lines[mid].byte_start <= edit_start) {
+                                lo = mid;
+                        }
+                        else {
+                                hi = mid;
+                        }
+                }
 
-        nbr_idx vtx;
-        struct nbr_cmd *cmd = nbi_cmd_begin(buf, data, NBR_CMD_TYPE_TRIANGLES, &vtx);
+                l0 = lo;
+                while(l0 && !cur->lines[l0].hard) {
+                        l0--;
+                }
 
-        float rect[4];
-        rect[0] = (float)rec.x; rect[1] = (float)rec.y;
-        rect[2] = (float)rec.w; rect[3] = (float)rec.h;
+                l1 = l0 + 1;
+                while(l1 < cur->line_count && !(cur->lines[l1].hard && cur->lines[l1].byte_start > old_edit_end)) {
+                        l1++;
+                }
 
-        uint32_t extent_min = (rec.w > 0 && rec.h > 0) ? (uint32_t)((rec.w < rec.h ? rec.w : rec.h) / 2) : 0;
-        if(radius > extent_min) {
-                radius = extent_min;
+                start = cur->lines[l0].byte_start;
         }
 
-        nbr_idx subdivs = radius >= 1 ? (nbr_idx)radius : 0;
-        if(subdivs > 7) {
-                subdivs = 7;
-        }
+        uint32_t last = l1 >= cur->line_count;
+        uint32_t end = last ? layout->text_len : (uint32_t)((int32_t)cur->lines[l1].byte_start + delta) - 1;
 
-        /* sharp corners - shortcut */
-        if(!subdivs) {
-                nbi_push_quad(data, vtx, rect, color);
-                nbi_cmd_end(data, cmd);
-                return;
+        tmp->line_count = 0;
+        tmp->glyph_count = 0;
+
+        if(!nbi_layout_range(layout, font, tmp, start, end)) {
+                return NB_FAIL;
         }
 
-        nbr_idx cv0 = vtx;
-        nbr_idx cv1 = vtx + (subdivs + 2);
-        nbr_idx cv2 = vtx + (subdivs + 2) * 2;
-        nbr_idx cv3 = vtx + (subdivs + 2) * 3;
+        /* splice the new lines and glyphs over the old ones */
+        uint32_t g0 = l0 < cur->line_count ? cur->lines[l0].glyph_start : cur->glyph_count;
+        uint32_t g1 = l1 < cur->line_count ? cur->lines[l1].glyph_start : cur->glyph_count;
 
-        nbi_push_quad_idxs(data, cv1 + 1, cv1, cv0, cv0 + (subdivs + 1));
-        nbi_push_quad_idxs(data, cv2 + 1, cv2, cv1, cv1 + (subdivs + 1));
-        nbi_push_quad_idxs(data, cv3 + 1, cv3, cv2, cv2 + (subdivs + 1));
-        nbi_push_quad_idxs(data, cv0 + 1, cv0, cv3, cv3 + (subdivs + 1));
-        nbi_push_quad_idxs(data, cv1, cv2, cv3, cv0);
+        uint32_t line_count = cur->line_count - (l1 - l0) + tmp->line_count;
+        uint32_t glyph_count = cur->glyph_count - (g1 - g0) + tmp->glyph_count;
+
+        if(!nbi_layout_reserve((void **)&cur->lines, &cur->line_cap, line_count, sizeof(*cur->lines)) ||
+           !nbi_layout_reserve((void **)&cur->glyphs, &cur->glyph_cap, glyph_count, sizeof(*cur->glyphs))) {
+                return NB_FAIL;
+        }
 
-        float cx, cy;
+        memmove(cur->lines + l0 + tmp->line_count, cur->lines + l1, sizeof(*cur->lines) * (cur->line_count - l1));
+        memcpy(cur->lines + l0, tmp->lines, sizeof(*cur->lines) * tmp->line_count);
 
-        cx = rect[0] + rect[2] - (float)radius;
-        cy = rect[1] + (float)radius;
-        nbi_push_round_corner(data, cx, cy, color, subdivs, radius, NB_TAU);
+        memmove(cur->glyphs + g0 + tmp->glyph_count, cur->glyphs + g1, sizeof(*cur->glyphs) * (cur->glyph_count - g1));
+        memcpy(cur->glyphs + g0, tmp->glyphs, sizeof(*cur->glyphs) * tmp->glyph_count);
 
-        cx = rect[0] + (float)radius;
-        cy = rect[1] + (float)radius;
-        nbi_push_round_corner(data, cx, cy, color, subdivs, radius, NB_TAU * 0.25f);
+        uint32_t i;
+        for(i = l0; i < l0 + tmp->line_count; i++) {
+                cur->lines[i].glyph_start += g0;
+        }
 
-        cx = rect[0] + (float)radius;
-        cy = rect[1] + rect[3] - (float)radius;
-        nbi_push_round_corner(data, cx, cy, color, subdivs, radius, NB_TAU * 0.5f);
+        int32_t glyph_delta = (int32_t)tmp->glyph_count - (int32_t)(g1 - g0);
+        for(; i < line_count; i++) {
+                cur->lines[i].glyph_start = (uint32_t)((int32_t)cur->lines[i].glyph_start + glyph_delta);
+                cur->lines[i].byte_start = (uint32_t)((int32_t)cur->lines[i].byte_start + delta);
+        }
 
-        cx = rect[0] + rect[2] - (float)radius;
-        cy = rect[1] + rect[3] - (float)radius;
-        nbi_push_round_corner(data, cx, cy, color, subdivs, radius, NB_TAU * 0.75f);
+        cur->line_count = line_count;
+        cur->glyph_count = glyph_count;
 
-        nbi_cmd_end(data, cmd);
+        return NB_OK;
 }
 
 
-void
-nbr_line(
-        struct nb_renderer_ctx *ctx,
-        struct nbr_cmd_buf *buf,
-        float *p,
-        float *q,
-        uint32_t color)
-{
-        (void)ctx;
-
-        struct nbr_vtx_buf *data = &buf->vtx_buf;
+static nb_result
+nbi_layout_rebuild(struct nbr_text_layout *layout) {
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
+        struct nb_font_tex atlas;
+        nb_get_font_atlas(layout->ctx, &atlas);
 
-        nbr_idx vtx;
-        struct nbr_cmd *cmd = nbi_cmd_begin(buf, data, NBR_CMD_TYPE_LINES, &vtx);
+        layout->generation = atlas.generation;
+        layout->font_height = font->height;
+        layout->cur.line_count = 0;
+        layout->cur.glyph_count = 0;
 
-        nbi_push_idx(data, vtx);
-        nbi_push_idx(data, vtx + 1);
+        return nbi_layout_update(layout, 0, 0, 0);
+}
 
-        nbi_push_vtx(data, p[0], p[1], color);
-        nbi_push_vtx(data, q[0], q[1], color);
 
-        nbi_cmd_end(data, cmd);
+/* the atlas was rebaked or the font height changed since the last layout */
+static int
+nbi_layout_stale(struct nbr_text_layout *layout) {
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
+        return layout->generation != layout->ctx->atlas.generation || layout->font_height != font->height;
 }
 
 
-void
-nbr_bez(
-        struct nb_renderer_ctx *ctx,
-        struct nbr_cmd_buf *buf,
-        float *p0,
-        float *p1,
-        float *p2,
-        float *p3,
-        uint32_t color)
+nb_result
+nbr_text_layout_create(
+        nbr_ctx_t ctx,
+        uint32_t font,
+        uint32_t flags,
+        float width,
+        nbr_text_layout_t *out_layout)
 {
-        (void)ctx;
+        if(!ctx || !out_layout || font >= ctx->font_count) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
 
-        struct nbr_vtx_buf * data = &buf->vtx_buf;
+        struct nbr_text_layout *layout = NB_ALLOC(sizeof(*layout));
+        if(!layout) {
+                NB_ASSERT(!"NB_FAIL");
+                return NB_FAIL;
+        }
 
-        nbr_idx vtx;
-        struct nbr_cmd * cmd = nbi_cmd_begin(buf, data, NBR_CMD_TYPE_LINES, &vtx);
+        NB_ZERO_MEM(layout);
+        layout->ctx = ctx;
+        layout->font = font;
+        layout->flags = flags & (_NB_TEXT_ALIGN_BIT_MASK | NBI_TEXT_FLAGS_WRAP);
+        layout->width = width;
+
+        /* never null, so empty text and splices need no special case */
+        if(!nbi_layout_reserve((void **)&layout->text, &layout->text_cap, 1, 1) ||
+           !nbi_layout_reserve((void **)&layout->cur.lines, &layout->cur.line_cap, 1, sizeof(struct nbi_layout_line)) ||
+           !nbi_layout_reserve((void **)&layout->cur.glyphs, &layout->cur.glyph_cap, 1, sizeof(struct nbi_layout_glyph)) ||
+           !nbi_layout_reserve((void **)&layout->tmp.lines, &layout->tmp.line_cap, 1, sizeof(struct nbi_layout_line)) ||
+           !nbi_layout_reserve((void **)&layout->tmp.glyphs, &layout->tmp.glyph_cap, 1, sizeof(struct nbi_layout_glyph))) {
+                nbr_text_layout_destroy(&layout);
+                return NB_FAIL;
+        }
 
-        nbr_idx seg_count = 16;
-        nbr_idx i;
+        layout->text[0] = 0;
 
-        for(i = 0; i < seg_count; i++) {
-                nbi_push_idx(data, vtx + i);
+        if(nbi_layout_rebuild(layout) != NB_OK) {
+                nbr_text_layout_destroy(&layout);
+                return NB_FAIL;
         }
 
-        for(i = 0; i < seg_count; i++) {
-                float t = (float)i / (float)(seg_count - 1);
-                float t2 = t * t;
-                float t3 = t2 * t;
+        *out_layout = layout;
 
-                float u = (1.0f - t);
-                float u2 = u * u;
-                float u3 = u2 * u;
+        return NB_OK;
+}
 
-                float px = u3 * p0[0] + (3 * u2 * t) * p1[0] + (3 * u * t2) * p2[0] + t3 * p3[0];
-                float py = u3 * p0[1] + (3 * u2 * t) * p1[1] + (3 * u * t2) * p2[1] + t3 * p3[1];
 
-                nbi_push_vtx(data, px, py, color);
+nb_result
+nbr_text_layout_destroy(
+        nbr_text_layout_t *layout)
+{
+        if(!layout || !*layout) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
         }
 
-        nbi_cmd_end(data, cmd);
+        struct nbr_text_layout *kill = *layout;
+
+        if(kill->text) { NB_FREE(kill->text); }
+        if(kill->cur.lines) { NB_FREE(kill->cur.lines); }
+        if(kill->cur.glyphs) { NB_FREE(kill->cur.glyphs); }
+        if(kill->tmp.lines) { NB_FREE(kill->tmp.lines); }
+        if(kill->tmp.glyphs) { NB_FREE(kill->tmp.glyphs); }
+
+        NB_FREE(kill);
+        *layout = 0;
+
+        return NB_OK;
 }
 
 
-struct nbi_text_out {
-        struct nbi_font *font;
+nb_result
+nbr_text_layout_set(
+        nbr_text_layout_t layout,
+        const char *str,
+        uint32_t len)
+{
+        if(!layout || (len && !str)) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
 
-        float start_x;
-        float end_x;
-        float max_x;
-        float x;
-        float y;
-        float space;
+        if(!nbi_layout_reserve((void **)&layout->text, &layout->text_cap, len + 1, 1)) {
+                return NB_FAIL;
+        }
 
-        uint32_t vtx_start;
-        uint32_t align_type;
-};
+        if(len) {
+                memcpy(layout->text, str, len);
+        }
+        layout->text[len] = 0;
+        layout->text_len = len;
 
+        return nbi_layout_rebuild(layout);
+}
 
-static void
-nbi_line_adv(struct nbr_vtx_buf * buf, struct nbi_text_out * out) {
-        if(out->align_type != NB_TEXT_ALIGN_LEFT) {
-                float offset = out->end_x - out->x;
-                if(offset < 0.0f) {
-                        offset = 0.0f;
-                }
-                if(out->align_type == NB_TEXT_ALIGN_CENTER) {
-                        offset *= 0.5f;
-                }
-                offset = (float)((int)offset);
 
-                if(buf) {
-                        uint32_t i;
-                        for(i = out->vtx_start; i < buf->vtx_count; i++) {
-                                buf->vtx[i].x += offset;
-                        }
+nb_result
+nbr_text_layout_insert(
+        nbr_text_layout_t layout,
+        uint32_t offset,
+        const char *str,
+        uint32_t len)
+{
+        if(!layout || !str || offset > layout->text_len) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
 
-                        out->vtx_start = buf->vtx_count;
-                }
+        if(!len) {
+                return NB_OK;
         }
 
-        if(out->x > out->max_x) {
-                out->max_x = out->x;
+        if(!nbi_layout_reserve((void **)&layout->text, &layout->text_cap, layout->text_len + len + 1, 1)) {
+                return NB_FAIL;
         }
 
-        out->x = out->start_x;
-        out->y += out->font->height;
-        out->space = 0.0f;
-}
+        char *at = layout->text + offset;
+        memmove(at + len, at, layout->text_len - offset + 1);
+        memcpy(at, str, len);
+        layout->text_len += len;
 
+        if(nbi_layout_stale(layout)) {
+                return nbi_layout_rebuild(layout);
+        }
 
-void
-nbr_text_(
-        struct nb_renderer_ctx *ctx,
-        struct nbr_cmd_buf *buf,
-        struct nbi_font *font,
-        struct nb_rect rect,
-        uint32_t flags,
-        uint32_t color,
-        const char *text,
-        float *out_size)
-{
-        (void)ctx;
+        return nbi_layout_update(layout, offset, offset, (int32_t)len);
+}
 
-        if(!text) {
-                if(out_size) {
-                        out_size[0] = 0.0f;
-                        out_size[1] = font->height;
-                }
 
-                return;
+nb_result
+nbr_text_layout_delete(
+        nbr_text_layout_t layout,
+        uint32_t offset,
+        uint32_t len)
+{
+        if(!layout || offset > layout->text_len) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
         }
 
-        uint32_t wrap = flags & NBI_TEXT_FLAGS_WRAP;
-        uint32_t term_tag = flags & NBI_TEXT_FLAGS_TERM;
+        if(len > layout->text_len - offset) {
+                len = layout->text_len - offset;
+        }
 
-        struct nbi_text_out out = { 0 };
-        out.font = font;
-        out.start_x = (float)rect.x;
-        out.end_x = (float)rect.x + (float)rect.w;
-        out.max_x = (float)rect.x;
-        out.x = (float)rect.x;
-        out.y = (float)rect.y + font->ascent;
-        out.align_type = flags & _NB_TEXT_ALIGN_BIT_MASK;
+        if(!len) {
+                return NB_OK;
+        }
 
-        struct nbr_vtx_buf * data = 0;
-        nbr_idx vtx = 0;
-        struct nbr_cmd * cmd = 0;
-        if(buf) {
-                data = &buf->vtx_buf;
-                cmd = nbi_cmd_begin(buf, data, NBR_CMD_TYPE_TRIANGLES, &vtx);
+        char *at = layout->text + offset;
+        memmove(at, at + len, layout->text_len - offset - len + 1);
+        layout->text_len -= len;
 
-                out.vtx_start = data->vtx_count;
+        if(nbi_layout_stale(layout)) {
+                return nbi_layout_rebuild(layout);
         }
 
-        char * it = (char *)text;
-        while(*it) {
-                uint32_t cp;
-                uint32_t cp_size = nbi_decode_utf8_cp(it, &cp);
+        return nbi_layout_update(layout, offset, offset + len, -(int32_t)len);
+}
 
-                char c = *it;
 
-                if(c == '\n') {
-                        nbi_line_adv(data, &out);
-                        it += cp_size;
-                }
-                else if(c == ' ') {
-                        out.space += out.font->space_width;
-                        it += cp_size;
-                }
-                else if(nbi_char_valid(out.font, cp)) {
-                        uint32_t i;
+nb_result
+nbr_text_layout_set_width(
+        nbr_text_layout_t layout,
+        float width)
+{
+        if(!layout) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
 
-                        char * word = it;
-                        uint32_t word_size = 0;
-                        while(*it && *it != '\n' && *it != ' ') {
-                                if(term_tag && strncmp(it, "##", 2) == 0) {
-                                        word_size = (uint32_t)(it - word);
-                                        it += strlen(it);
-                                        break;
-                                }
+        if(width == layout->width) {
+                return NB_OK;
+        }
 
-                                uint32_t word_cp;
-                                uint32_t word_cp_size = nbi_decode_utf8_cp(it, &word_cp);
-                                if(nbi_char_valid(out.font, word_cp)) {
-                                        it += word_cp_size;
-                                        word_size = (uint32_t)(it - word);
-                                }
-                                else {
-                                        word_size = (uint32_t)(it - word);
-                                        break;
-                                }
-                        }
+        layout->width = width;
 
+        /* alignment is applied when emitting */
+        if(!(layout->flags & NBI_TEXT_FLAGS_WRAP)) {
+                return NB_OK;
+        }
 
-                        if(wrap && out.x > out.start_x) {
-                                float word_end = out.x + out.space;
-                                for(i = 0; i < word_size;) {
-                                        uint32_t word_cp;
-                                        i += nbi_decode_utf8_cp(word + i, &word_cp);
-                                        word_end += nbi_get_glyph_width(out.font, word_cp);
-                                }
-                                if(word_end > out.end_x) {
-                                        nbi_line_adv(data, &out);
-                                }
-                        }
+        if(nbi_layout_stale(layout)) {
+                return nbi_layout_rebuild(layout);
+        }
 
-                        out.x += out.space;
-                        out.space = 0.0f;
+        /* a paragraph on one line that still fits wraps the same way */
+        struct nbi_layout_lines *cur = &layout->cur;
+        struct nbi_layout_lines *tmp = &layout->tmp;
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
 
-                        for(i = 0; i < word_size;) {
-                                uint32_t word_cp;
-                                i += nbi_decode_utf8_cp(word + i, &word_cp);
+        tmp->line_count = 0;
+        tmp->glyph_count = 0;
 
-                                float prev_x = out.x;
+        uint32_t i = 0;
+        while(i < cur->line_count) {
+                uint32_t next = i + 1;
+                while(next < cur->line_count && !cur->lines[next].hard) {
+                        next++;
+                }
 
-                                stbtt_aligned_quad q;
-                                nbi_get_glyph_quad(out.font, word_cp, &out.x, &out.y, &q);
+                struct nbi_layout_line *line = cur->lines + i;
 
-                                if(wrap && out.x > out.end_x) {
-                                        out.x = prev_x;
-                                        nbi_line_adv(data, &out);
-                                        nbi_get_glyph_quad(out.font, word_cp, &out.x, &out.y, &q);
-                                }
+                if(next == i + 1 && line->width <= width) {
+                        uint32_t glyph_start = tmp->glyph_count;
+                        if(!nbi_layout_reserve((void **)&tmp->glyphs, &tmp->glyph_cap, glyph_start + line->glyph_count, sizeof(*tmp->glyphs))) {
+                                return NB_FAIL;
+                        }
 
-                                if(data) {
-                                        nbi_push_quad_idxs(data, vtx, vtx + 1, vtx + 2, vtx + 3);
-                                        nbi_push_vtx_uv(data, q.x0, q.y0, q.s0, q.t0, color); vtx++;
-                                        nbi_push_vtx_uv(data, q.x0, q.y1, q.s0, q.t1, color); vtx++;
-                                        nbi_push_vtx_uv(data, q.x1, q.y1, q.s1, q.t1, color); vtx++;
-                                        nbi_push_vtx_uv(data, q.x1, q.y0, q.s1, q.t0, color); vtx++;
-                                }
+                        memcpy(tmp->glyphs + glyph_start, cur->glyphs + line->glyph_start, sizeof(*tmp->glyphs) * line->glyph_count);
+                        tmp->glyph_count += line->glyph_count;
+
+                        struct nbi_layout_line *copy = nbi_layout_push_line(tmp, line->byte_start, 1);
+                        if(!copy) {
+                                return NB_FAIL;
                         }
+
+                        copy->glyph_start = glyph_start;
+                        copy->glyph_count = line->glyph_count;
+                        copy->width = line->width;
                 }
                 else {
-                        it += cp_size;
+                        uint32_t end = next < cur->line_count ? cur->lines[next].byte_start - 1 : layout->text_len;
+                        if(!nbi_layout_paragraph(layout, font, tmp, line->byte_start, end)) {
+                                return NB_FAIL;
+                        }
                 }
+
+                i = next;
         }
 
-        if(flags & NBI_TEXT_FLAGS_CURSOR) {
-                float cursor_width = 1.0f;
+        /* swap the rebuilt lines in */
+        struct nbi_layout_lines swap = *cur;
+        *cur = *tmp;
+        *tmp = swap;
 
-                float prev_x = out.x;
+        return NB_OK;
+}
 
-                out.x += out.space;
-                if(wrap && out.x > out.start_x) {
-                        float cursor_end = out.x + cursor_width;
-                        if(cursor_end > out.end_x) {
-                                out.x = prev_x;
-                                nbi_line_adv(data, &out);
-                        }
-                }
 
-                if(buf) {
-                        uint32_t cursor_on = 1; /* ((uint32_t)(buf->ctx->state.text_cursor_time * 2.0f) & 1) == 0; */
-                        if(cursor_on) {
-                                float cursor_rect[4];
-                                cursor_rect[0] = out.x;
-                                cursor_rect[1] = out.y - font->ascent;
-                                cursor_rect[2] = cursor_width;
-                                cursor_rect[3] = font->height;
-                                vtx += nbi_push_quad(data, vtx, cursor_rect, color);
-                        }
-                }
+nb_result
+nbr_text_layout_get_size(
+        nbr_text_layout_t layout,
+        float *out_size)
+{
+        if(!layout || !out_size) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
 
-                out.x += cursor_width;
+        if(nbi_layout_stale(layout) && nbi_layout_rebuild(layout) != NB_OK) {
+                return NB_FAIL;
         }
 
-        nbi_line_adv(data, &out);
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
+        float width = 0.0f;
+        uint32_t i;
 
-        if(out_size) {
-                out_size[0] = out.max_x - rect.x;
-                out_size[1] = out.y - (rect.y + font->ascent);
+        for(i = 0; i < layout->cur.line_count; i++) {
+                if(layout->cur.lines[i].width > width) {
+                        width = layout->cur.lines[i].width;
+                }
         }
 
-        if(data) {
-                nbi_cmd_end(data, cmd);
-        }
+        out_size[0] = width;
+        out_size[1] = font->height * (float)layout->cur.line_count;
+
+        return NB_OK;
 }
 
+
 void
-nbr_get_text_size(
-        struct nb_renderer_ctx * ctx,
-        float width,
-        uint32_t flags,
-        const char *text,
-        float *out_size)
+nbr_text_layout_emit(
+        nbr_text_layout_t layout,
+        struct nbr_cmd_buf *buf,
+        struct nb_rect rect,
+        int scroll,
+        uint32_t color)
 {
-        if(!ctx || !out_size) {
+        if(!layout || !buf) {
                 NB_ASSERT(!"Invalid params");
                 return;
         }
 
-        struct nbi_font * font = ctx->font;
-        struct nb_rect rect;
-        rect.x = 0; rect.y = 0; rect.w = (int)width; rect.h = 0;
-        nbr_text_(ctx, 0, font, rect, flags, 0, text, out_size);
-}
+        if(nbi_layout_stale(layout) && nbi_layout_rebuild(layout) != NB_OK) {
+                return;
+        }
 
+        struct nbi_font *font = nbi_font_get(layout->ctx, layout->font);
+        struct nbi_layout_lines *cur = &layout->cur;
 
-void
-nbr_text(
-        struct nb_renderer_ctx *ctx,
-        struct nbr_cmd_buf *buf,
-        struct nb_rect rect,
-        uint32_t flags,
-        uint32_t color,
-        const char *text)
-{
-        struct nbi_font *font = ctx->font;
-        nbr_text_(ctx, buf, font, rect, flags, color, text, 0);
-}
+        if(rect.h <= 0 || !cur->line_count || font->height <= 0.0f) {
+                return;
+        }
 
+        /* only the part of the rect that can be seen needs lines */
+        float top = (float)rect.y;
+        float bot = (float)(rect.y + rect.h);
 
-void
-nbr_scissor_set(
-        struct nbr_cmd_buf *buf,
-        struct nb_rect rect)
-{
-        struct nbr_cmd *cmd = nbi_cmd_push(buf);
-        if(cmd) {
-                cmd->type = NBR_CMD_TYPE_SCISSOR;
-                cmd->data.clip_rect[0] = (int16_t)rect.x;
-                cmd->data.clip_rect[1] = (int16_t)rect.y;
-                cmd->data.clip_rect[2] = (int16_t)rect.w;
-                cmd->data.clip_rect[3] = (int16_t)rect.h;
+        struct nbi_cull cull;
+        nbi_cull_init(layout->ctx, buf, 1, &cull);
+        if(cull.active) {
+                if(nbi_culled(&cull, (float)rect.x, top, 1e30f, bot, font->height)) {
+                        return;
+                }
+
+                top = cull.y0 - font->height > top ? cull.y0 - font->height : top;
+                bot = cull.y1 + font->height < bot ? cull.y1 + font->height : bot;
         }
-}
 
+        /* lines are all one height, so the visible ones are a range */
+        float first_f = (top - (float)rect.y + (float)scroll) / font->height;
+        float last_f = (bot - (float)rect.y + (float)scroll) / font->height;
 
-void
-nbr_scissor_clear(struct nbr_cmd_buf *buf) {
-        struct nbr_cmd *cmd = nbi_cmd_push(buf);
-        if(cmd) {
-                cmd->type = NBR_CMD_TYPE_SCISSOR;
-                cmd->data.clip_rect[0] = 0;
-                cmd->data.clip_rect[1] = 0;
-                cmd->data.clip_rect[2] = 0x7FFF;
-                cmd->data.clip_rect[3] = 0x7FFF;
+        uint32_t first = first_f > 0.0f ? (uint32_t)first_f : 0;
+        uint32_t last = last_f > 0.0f ? (uint32_t)last_f + 1 : 0;
+        if(last > cur->line_count) {
+                last = cur->line_count;
         }
-}
 
+        if(first >= last) {
+                return;
+        }
 
-nb_result
-nb_debug_set_font(
-        struct nb_renderer_ctx * ctx,
-        uint32_t idx)
-{
-        NB_ASSERT(ctx);
-        NB_ASSERT(idx < ctx->font_count);
+        uint32_t align = layout->flags & _NB_TEXT_ALIGN_BIT_MASK;
+        uint32_t i, j;
 
-        ctx->debug_font_next = ctx->fonts + idx;
+        uint32_t glyph_count = 0;
+        for(i = first; i < last; i++) {
+                glyph_count += cur->lines[i].glyph_count;
+        }
 
-        return NB_OK;
+        struct nbi_text_emit emit;
+        emit.chunk = nbi_cmd_buf_reserve(buf, glyph_count * 4, glyph_count * 6);
+        emit.data = &emit.chunk->vtx_buf;
+        emit.cmd = nbi_cmd_begin(emit.chunk, emit.data, NBR_CMD_TYPE_TRIANGLES, 4, &emit.vtx);
+        emit.clip = nbi_clip_top(buf);
+        emit.color = color;
+
+        for(i = first; i < last; i++) {
+                struct nbi_layout_line *line = cur->lines + i;
+
+                float ox = (float)rect.x + nbi_align_offset(align, layout->width, line->width);
+                float oy = (float)(rect.y - scroll) + font->height * (float)i;
+
+                const struct nbi_layout_glyph *g = cur->glyphs + line->glyph_start;
+
+                for(j = 0; j < line->glyph_count; j++, g++) {
+                        stbtt_aligned_quad q;
+                        q.x0 = g->x0; q.y0 = oy + g->y0; q.s0 = g->s0; q.t0 = g->t0;
+                        q.x1 = g->x1; q.y1 = oy + g->y1; q.s1 = g->s1; q.t1 = g->t1;
+                        nbi_text_emit_glyph(&emit, &q, ox);
+                }
+        }
+
+        nbi_cmd_end(emit.data, emit.cmd);
 }
 
 
@@ -1214,7 +5839,8 @@ nb_debug_set_font(
 
 nb_result
 nbr_ctx_create(
-        nbr_ctx_t *out_ctx)
+        nbr_ctx_t *out_ctx,
+        const struct nbr_ctx_desc *desc)
 {
         if (!out_ctx) {
                 NB_ASSERT(!"NB_INVALID_PARAMS");
@@ -1230,24 +5856,31 @@ nbr_ctx_create(
 
         NB_ZERO_MEM(ctx);
 
-        struct nbi_font_info { uint8_t * ttf; float height; };
-        struct nbi_font_info fi[] = {
-                { NB_OPEN_SANS_TTF, 16.0f, },
-                { NB_PROGGY_TTF, 11.0f, },
-        };
-
-        ctx->font_count = NB_ARR_COUNT(fi);
-        if(ctx->font_count > NB_ARR_COUNT(ctx->fonts)) {
-                NB_ASSERT(!"More Fonts that storage, increase size");
-                ctx->font_count = NB_ARR_COUNT(ctx->fonts);
+        if (desc) {
+                ctx->job_dispatch = desc->job_dispatch;
+                ctx->job_user_data = desc->job_user_data;
+                ctx->atlas.mode = desc->font_mode;
+                ctx->anti_alias = desc->anti_alias;
         }
 
-        uint32_t i;
-        for(i = 0; i < ctx->font_count; i++) {
-                nbi_font_init(ctx->fonts + i, fi[i].ttf, fi[i].height);
+#if NBR_FONT_EMBED_OPEN_SANS
+        nbi_font_push(ctx, NB_OPEN_SANS_TTF, 16.0f);
+#endif
+
+#if NBR_FONT_EMBED_PROGGY
+        nbi_font_push(ctx, NB_PROGGY_TTF, 11.0f);
+#endif
+
+        if (nbi_atlas_build(ctx) != NB_OK) {
+                NB_ASSERT(!"NB_FAIL");
+                goto CTX_CLEANUP_AND_FAIL;
         }
 
-        ctx->font = ctx->fonts;
+        nbi_corners_init(ctx);
+
+        /* every embed switch can be off, text is skipped until a font is added */
+        ctx->font = ctx->font_count ? ctx->fonts : 0;
+        ctx->ref_count = 1;
 
         *out_ctx = ctx;
 
@@ -1257,6 +5890,7 @@ nbr_ctx_create(
         CTX_CLEANUP_AND_FAIL:
 
         if (ctx) {
+                nbi_atlas_release(ctx);
                 NB_FREE(ctx);
         }
 
@@ -1264,16 +5898,47 @@ nbr_ctx_create(
 }
 
 
+nb_result
+nbr_ctx_retain(
+        nbr_ctx_t ctx)
+{
+        if (!ctx) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        NBR_ATOMIC_INC(&ctx->ref_count);
+
+        return NB_OK;
+}
+
+
 nb_result
 nbr_ctx_destroy(
         nbr_ctx_t *c)
 {
-        if (!c) {
+        if (!c || !*c) {
                 NB_ASSERT(!"NB_INVALID_PARAMS");
                 return NB_INVALID_PARAMS;
         }
 
-        return NB_FAIL;
+        struct nb_renderer_ctx *ctx = *c;
+        *c = 0;
+
+        if (NBR_ATOMIC_DEC(&ctx->ref_count) > 0) {
+                return NB_OK;
+        }
+
+        nbi_atlas_release(ctx);
+
+        uint32_t i;
+        for(i = 0; i < ctx->file_count; i++) {
+                nbi_file_unmap(ctx->files + i);
+        }
+
+        NB_FREE(ctx);
+
+        return NB_OK;
 }
 
 
@@ -1319,6 +5984,22 @@ nbr_viewport_get(
 }
 
 
+void
+nbr_cmd_buf_set_viewport(
+        struct nbr_cmd_buf *buf,
+        uint32_t width,
+        uint32_t height)
+{
+        if(!buf) {
+                NB_ASSERT(!"nbr_cmd_buf_set_viewport: NB_INVALID_PARAMS");
+                return;
+        }
+
+        buf->viewport[0] = width;
+        buf->viewport[1] = height;
+}
+
+
 /* ---------------------------------------------------------------- Config -- */
 
 
@@ -1327,6 +6008,9 @@ nbr_viewport_get(
 #undef NB_FREE
 #undef NB_ZERO_MEM
 #undef NB_ARR_COUNT
+#undef NBR_ATOMIC_INC
+#undef NBR_ATOMIC_DEC
+#undef NBR_ATOMIC_LOAD
 
 
 #endif
@@ -22,6 +22,21 @@ nbs_ctx_create(
         nbs_ctx_t * ctx);
 
 
+/*
+ *  Creates a ctx that draws with an existing renderer ctx instead of baking
+ *  its own fonts, the renderer ctx is retained until this ctx is destroyed.
+ *  Each ctx still has its own core ctx and windows.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx or rdr_ctx is null
+ *  returns `NB_FAIL` if an internal error occured
+ */
+nb_result
+nbs_ctx_create_shared(
+        nbs_ctx_t * ctx,
+        nbr_ctx_t rdr_ctx);
+
+
 /*
  *  returns `NB_OK` on success
  *  returns `NB_INVALID_PARAMS` if ctx is null
@@ -76,6 +91,34 @@ nbs_get_draw_data(
         struct nbr_draw_data *data);       /* required */
 
 
+/*
+ *  Sets the viewport this ctx draws into. It goes out with the draw data and
+ *  culls the windows, the renderer ctx viewport is left alone as other ctxs
+ *  can share it.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx is null
+ */
+nb_result
+nbs_viewport_set(
+        nbs_ctx_t ctx,                      /* required */
+        uint32_t width,
+        uint32_t height);
+
+
+/*
+ *  Sets the renderer ctx font the widgets of this ctx use, the first one
+ *  by default.
+ *
+ *  returns `NB_OK` on success
+ *  returns `NB_INVALID_PARAMS` if ctx is null
+ */
+nb_result
+nbs_font_set(
+        nbs_ctx_t ctx,                      /* required */
+        uint32_t font);
+
+
 /* -------------------------------------------------------- Window widgets -- */
 
 
@@ -111,10 +154,6 @@ nbs_button(
 #define NEB_SUGAR_IMPL_INCLUDED
 
 
-#include "nebula_font_open_sans.h"
-#include "nebula_font_proggy.h"
-#include "nebula_font_awesome.h"
-
 #include <nebula/core.h>
 #include <nebula/renderer.h>
 
@@ -140,6 +179,10 @@ struct nbs_ctx {
 
         struct nbr_cmd_buf *draw_bufs[32];
         uint32_t draw_buf_count;
+
+        /* per ctx, the renderer ctx may be shared */
+        uint32_t viewport[2];
+        uint32_t font;
 };
 
 
@@ -345,27 +388,22 @@ nbs_window_begin(
 
         struct nb_rect wrect = window->rect;
 
-        /* border */
-        int bo_rad = NB_THEME_WIN_CORNER_RADIUS + NB_THEME_WIN_BORDER_SIZE;
-        uint32_t bocolor = NB_THEME_WIN_BORDER_COLOR;
-        struct nb_rect nbrect = nb_rect_expand(wrect, NB_THEME_WIN_BORDER_SIZE);
-
-        nbr_box(ctx->rdr_ctx, window->cmd_buf, nbrect, bocolor, bo_rad);
-
-        /* body */
+        /* body and border */
         int b_rad = NB_THEME_WIN_CORNER_RADIUS;
+        uint32_t bocolor = NB_THEME_WIN_BORDER_COLOR;
         uint32_t bgcolor = bgcol;
 
-        nbr_box(ctx->rdr_ctx, window->cmd_buf, wrect, bgcolor, b_rad);
+        nbr_box_bordered(ctx->rdr_ctx, window->cmd_buf, wrect, bgcolor, b_rad, bocolor, NB_THEME_WIN_BORDER_SIZE);
 
         /* title */
         struct nb_rect trect = nb_rect_expand(wrect, -NB_THEME_WIN_PADDING);
         uint32_t txtc = NB_THEME_WIN_TITLE_TXT_COLOR;
 
-        nbr_scissor_set(window->cmd_buf, trect);
-        nbr_text(ctx->rdr_ctx, window->cmd_buf, trect, 0, txtc, name);
+        uint32_t font = ctx->font;
 
-        nbr_scissor_clear(window->cmd_buf);
+        nbr_clip_push(window->cmd_buf, trect);
+        nbr_text(ctx->rdr_ctx, window->cmd_buf, font, trect, NBI_TEXT_FLAGS_ELLIPSIS, txtc, name);
+        nbr_clip_pop(window->cmd_buf);
 
         window->cursor = 30;
 
@@ -401,8 +439,9 @@ nbs_button(
         uint64_t hash_key = nbi_hash_str(name);
 
         float txt_size[2];
-        uint32_t txt_flags = NB_TEXT_ALIGN_CENTER;
-        nbr_get_text_size(ctx->rdr_ctx, (float)win->rect.w, txt_flags, name, txt_size);
+        uint32_t txt_flags = NB_TEXT_ALIGN_CENTER | NBI_TEXT_FLAGS_ELLIPSIS;
+        uint32_t font = ctx->font;
+        nbr_get_text_size(ctx->rdr_ctx, font, (float)win->rect.w, txt_flags, name, txt_size);
 
         struct nb_rect rect;
         rect.x = win->rect.x + NB_THEME_WIN_PADDING;
@@ -433,26 +472,19 @@ nbs_button(
                 bgcol = NB_THEME_BUT_BG_DOWN;
         }
 
-        /* border */
-        int bo_rad = NB_THEME_BUT_CORNER_RADIUS + NB_THEME_BUT_BORDER_SIZE;
-        uint32_t bocolor = NB_THEME_BUT_BORDER_COLOR;
-        struct nb_rect nbrect = nb_rect_expand(rect, NB_THEME_BUT_BORDER_SIZE);
-
-        nbr_box(ctx->rdr_ctx, win->cmd_buf, nbrect, bocolor, bo_rad);
-
-        /* body */
+        /* body and border */
         int b_rad = NB_THEME_BUT_CORNER_RADIUS;
+        uint32_t bocolor = NB_THEME_BUT_BORDER_COLOR;
         uint32_t bgcolor = bgcol;
 
-        nbr_box(ctx->rdr_ctx, win->cmd_buf, rect, bgcolor, b_rad);
+        nbr_box_bordered(ctx->rdr_ctx, win->cmd_buf, rect, bgcolor, b_rad, bocolor, NB_THEME_BUT_BORDER_SIZE);
 
         /* text */
         uint32_t txtc = NB_THEME_BUT_TXT_COLOR;
 
-        nbr_scissor_set(win->cmd_buf, rect);
-        nbr_text(ctx->rdr_ctx, win->cmd_buf, rect, txt_flags, txtc, name);
-
-        nbr_scissor_clear(win->cmd_buf);
+        nbr_clip_push(win->cmd_buf, rect);
+        nbr_text(ctx->rdr_ctx, win->cmd_buf, font, rect, txt_flags, txtc, name);
+        nbr_clip_pop(win->cmd_buf);
 
         if(inter.flags & NB_INTERACT_CLICKED) {
                 return 1;
@@ -548,17 +580,59 @@ nbs_get_draw_data(
 
         data->cmd_bufs = ctx->draw_bufs;
         data->cmd_buf_count = ctx->draw_buf_count;
+        data->viewport[0] = ctx->viewport[0];
+        data->viewport[1] = ctx->viewport[1];
 
         return NB_OK;
 
 }
 
-/* -------------------------------------------------------------- Lifetime -- */
+
+nb_result
+nbs_viewport_set(
+        nbs_ctx_t ctx,
+        uint32_t width,
+        uint32_t height)
+{
+        if(!ctx) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        ctx->viewport[0] = width;
+        ctx->viewport[1] = height;
+
+        uint32_t i;
+        for(i = 0; i < NB_ARR_COUNT(ctx->window_bufs); ++i) {
+                nbr_cmd_buf_set_viewport(ctx->window_bufs[i], width, height);
+        }
+
+        return NB_OK;
+}
 
 
 nb_result
-nbs_ctx_create(
-        nbs_ctx_t * ctx)
+nbs_font_set(
+        nbs_ctx_t ctx,
+        uint32_t font)
+{
+        if(!ctx) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        ctx->font = font;
+
+        return NB_OK;
+}
+
+/* -------------------------------------------------------------- Lifetime -- */
+
+
+static nb_result
+nbsi_ctx_create(
+        nbs_ctx_t * ctx,
+        nbr_ctx_t rdr_ctx)
 {
         if(!ctx) {
                 NB_ASSERT(!"NB_INVALID_PARAMS");
@@ -566,12 +640,13 @@ nbs_ctx_create(
         }
 
         struct nbs_ctx *new_ctx = NB_ALLOC(sizeof(*new_ctx));
-        NB_ZERO_MEM(new_ctx);
 
         if (!new_ctx) {
                 goto CTX_FAIL_CLEANUP;
         }
 
+        NB_ZERO_MEM(new_ctx);
+
         nb_result ok = NB_OK;
 
         new_ctx->core_ctx = 0;
@@ -583,8 +658,14 @@ nbs_ctx_create(
         }
 
         new_ctx->rdr_ctx = 0;
-        ok = nbr_ctx_create(&new_ctx->rdr_ctx);
-        NB_ASSERT(new_ctx->rdr_ctx && "Failed to create renderer ctx");
+        if (rdr_ctx) {
+                ok = nbr_ctx_retain(rdr_ctx);
+                new_ctx->rdr_ctx = rdr_ctx;
+        }
+        else {
+                ok = nbr_ctx_create(&new_ctx->rdr_ctx, 0);
+                NB_ASSERT(new_ctx->rdr_ctx && "Failed to create renderer ctx");
+        }
 
         if (ok != NB_OK) {
                 goto CTX_FAIL_CLEANUP;
@@ -633,17 +714,52 @@ nbs_ctx_create(
 }
 
 
+nb_result
+nbs_ctx_create(
+        nbs_ctx_t * ctx)
+{
+        return nbsi_ctx_create(ctx, 0);
+}
+
+
+nb_result
+nbs_ctx_create_shared(
+        nbs_ctx_t * ctx,
+        nbr_ctx_t rdr_ctx)
+{
+        if(!rdr_ctx) {
+                NB_ASSERT(!"NB_INVALID_PARAMS");
+                return NB_INVALID_PARAMS;
+        }
+
+        return nbsi_ctx_create(ctx, rdr_ctx);
+}
+
 
 nb_result
 nbs_ctx_destroy(
         nbs_ctx_t * ctx)
 {
-        if (!ctx && !*ctx) {
+        if (!ctx || !*ctx) {
                 NB_ASSERT(!"NB_INVALID_PARAMS");
                 return NB_INVALID_PARAMS;
         }
 
         struct nbs_ctx *kill_ctx = *ctx;
+
+        if (kill_ctx->core_ctx) {
+                nbc_ctx_destroy(&kill_ctx->core_ctx);
+        }
+
+        /* only frees the renderer ctx once no other sugar ctx shares it */
+        if (kill_ctx->rdr_ctx) {
+                nbr_ctx_destroy(&kill_ctx->rdr_ctx);
+        }
+
+        if (kill_ctx->window_mem) {
+                NB_FREE(kill_ctx->window_mem);
+        }
+
         NB_FREE(kill_ctx);
 
         *ctx = 0;